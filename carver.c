@@ -0,0 +1,2759 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "carver.h"
+#include "energy.h"
+#include "simd.h"
+#include "thread-pool.h"
+#include "trace.h"
+
+// ARENA //////////////////////////////////////////////////////////////////////
+
+// Every working buffer of a carver comes out of a single block. The buffers
+// are laid out twice: once without a block, only to measure its size, then
+// again in a block of that size, so each buffer's size is only worked out in
+// one place.
+
+struct arena {
+    unsigned char *data;
+    size_t size;
+    size_t used;
+};
+
+static void * arena_allocate(struct arena *arena, size_t size) {
+    // Every buffer starts on its own cache line. Returns NULL while
+    // measuring.
+    size_t start = (arena->used + 63) & ~(size_t) 63;
+    arena->used = start + size;
+
+    return arena->data ? arena->data + start : NULL;
+}
+
+// IMAGES /////////////////////////////////////////////////////////////////////
+
+static unsigned char * image_pixel(const struct image_view *img, int x, int y) {
+    return img->data + (y * img->stride + x) * 3;
+}
+
+// ENERGY /////////////////////////////////////////////////////////////////////
+
+// The energy buffers use the same stride as the image they are computed from.
+
+static void compute_energy_rows(
+        const struct image_view *img,
+        const unsigned char *luma,
+        enum carver_energy energy_function,
+        unsigned int *energy,
+        int y0,
+        int y1) {
+    for (int y = y0; y < y1; y++) {
+        energy_span(
+                energy_function,
+                img,
+                luma,
+                y,
+                0,
+                img->w,
+                energy + y * img->stride);
+    }
+}
+
+static int energy_band_rows(int w) {
+    // Each row of energy reads 3 bytes per pixel and writes 4, so a band of
+    // this many rows fits in the L2 cache, with room to spare for the rows
+    // just above and below the band.
+    long cache_size = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (cache_size <= 0) { cache_size = 256 * 1024; }
+
+    long rows = cache_size / ((long) w * 7) - 2;
+    return rows < 1 ? 1 : rows;
+}
+
+struct energy_bands {
+    const struct image_view *img;
+    const unsigned char *luma;
+    enum carver_energy energy_function;
+    unsigned int *energy;
+    int band_rows;
+};
+
+static void compute_energy_band(void *context, int band) {
+    const struct energy_bands *bands = context;
+    int y0 = band * bands->band_rows;
+    int y1 = y0 + bands->band_rows;
+
+    compute_energy_rows(
+            bands->img,
+            bands->luma,
+            bands->energy_function,
+            bands->energy,
+            y0,
+            y1 < bands->img->h ? y1 : bands->img->h);
+}
+
+static void compute_energy(
+        const struct image_view *img,
+        const unsigned char *luma,
+        enum carver_energy energy_function,
+        unsigned int *energy,
+        struct thread_pool *pool) {
+    // Every pixel's energy only depends on the image, so the rows are split
+    // into bands computed in parallel.
+    struct energy_bands bands = {
+        .img = img,
+        .luma = luma,
+        .energy_function = energy_function,
+        .energy = energy,
+        .band_rows = energy_band_rows(img->w)
+    };
+
+    thread_pool_parallel_for(
+            pool,
+            (img->h + bands.band_rows - 1) / bands.band_rows,
+            compute_energy_band,
+            &bands);
+}
+
+// SEAMS //////////////////////////////////////////////////////////////////////
+
+struct seam_links {
+    // The minimal energy for any connected seam ending at each position. Each
+    // row is padded with a sentinel column of UINT_MAX on each side, which is
+    // never chosen as a parent.
+    //
+    // Only the last `num_rows` rows are kept, with row y stored at index
+    // y % num_rows. Finding a seam only needs the previous row and the last
+    // row, so normally only two rows are kept, or one more than a band of
+    // rows when the rows are computed in bands. Updating the links
+    // incrementally needs every row.
+    unsigned int *energy;
+    int num_rows;
+
+    // The offset from each position to its parent, -1, 0 or +1 along the X
+    // coordinate for vertical seams, Y for horizontal seams. The offsets are
+    // stored as offset + 1, packed 2 bits per position.
+    unsigned char *parents;
+
+    // The number of positions allocated for each row, not including the
+    // sentinels. Like the image stride, this stays fixed as seams are
+    // removed.
+    int stride;
+
+    // Scratch space for one row of energies and parent offsets.
+    unsigned int *scratch_energy;
+    signed char *scratch_parent_offsets;
+};
+
+static unsigned int * seam_links_row(const struct seam_links *links, int row) {
+    return links->energy + (row % links->num_rows) * (links->stride + 2) + 1;
+}
+
+static unsigned char * seam_links_parents_row(
+        const struct seam_links *links,
+        int row) {
+    return links->parents + row * ((links->stride + 3) / 4);
+}
+
+static int parent_offset_at(const unsigned char *parents_row, int coordinate) {
+    int shift = (coordinate % 4) * 2;
+    return ((parents_row[coordinate / 4] >> shift) & 3) - 1;
+}
+
+static void set_parent_offset_at(
+        unsigned char *parents_row,
+        int coordinate,
+        int parent_offset) {
+    int shift = (coordinate % 4) * 2;
+    unsigned char packed = parents_row[coordinate / 4] & ~(3 << shift);
+    parents_row[coordinate / 4] = packed | ((parent_offset + 1) << shift);
+}
+
+static void remove_parent_offset_at(
+        unsigned char *parents_row,
+        int coordinate,
+        int num_offsets) {
+    // Shifts every offset after `coordinate` down by one position, a whole
+    // byte at a time where possible.
+    int byte = coordinate / 4;
+    int last_byte = (num_offsets - 1) / 4;
+    unsigned char kept_mask = (1 << ((coordinate % 4) * 2)) - 1;
+
+    unsigned char next = byte < last_byte ? parents_row[byte + 1] : 0;
+    parents_row[byte] =
+        (parents_row[byte] & kept_mask) |
+        ((parents_row[byte] >> 2) & ~kept_mask) |
+        (next << 6);
+
+    for (byte++; byte <= last_byte; byte++) {
+        next = byte < last_byte ? parents_row[byte + 1] : 0;
+        parents_row[byte] = (parents_row[byte] >> 2) | (next << 6);
+    }
+}
+
+static void allocate_seam_links(
+        struct seam_links *links,
+        struct arena *arena,
+        int stride,
+        int seam_length,
+        int num_rows) {
+    links->num_rows = num_rows;
+    links->stride = stride;
+    links->energy = arena_allocate(
+            arena,
+            (size_t) num_rows * (stride + 2) * sizeof(unsigned int));
+    links->parents =
+        arena_allocate(arena, (size_t) seam_length * ((stride + 3) / 4));
+    links->scratch_energy =
+        arena_allocate(arena, stride * sizeof(unsigned int));
+    links->scratch_parent_offsets = arena_allocate(arena, stride);
+}
+
+// Each row of vertical seam links only depends on the row above, so the work
+// within a row can be split between threads. On wide images, each row is
+// simply split into chunks computed in parallel, waiting for every chunk
+// before moving on to the next row. On narrower images, that wait would cost
+// more than the row itself, so the rows are instead computed in bands,
+// without waiting between the rows of a band.
+//
+// Each band is split into column tiles. Every position only depends on the
+// three positions above it, so starting from a complete row, each tile can
+// compute a trapezoid, narrowing by one column on each side per row, without
+// needing anything from its neighbors. Once every trapezoid is done, the
+// triangles left between them are filled in, again in parallel. That's two
+// waits per band instead of one per row.
+//
+// The parents are packed 4 per byte, so the tile boundaries are multiples of
+// 4, and within each row, a trapezoid only sets the parents of the bytes it
+// fully covers. The triangle between two trapezoids sets the parents of the
+// bytes they share, recomputing the few positions of those bytes that belong
+// to the trapezoids.
+
+// The number of rows in a band, for which the links must keep one more row.
+#define SEAM_LINKS_BAND_ROWS 32
+
+// The narrowest tile, leaving the trapezoids plenty of room at the bottom of
+// a band, and the narrowest chunk worth waiting for at the end of every row.
+#define SEAM_LINKS_MIN_TILE_COLUMNS (4 * SEAM_LINKS_BAND_ROWS)
+#define SEAM_LINKS_MIN_ROW_CHUNK_COLUMNS 8192
+
+// Computing the energy along with the links, the energy of this many columns
+// is computed at a time, along with the three rows of pixels it reads and
+// the links it feeds into, fits in the L1 cache.
+#define FUSED_ENERGY_CHUNK_COLUMNS 1024
+
+struct vertical_seam_links_band {
+    struct seam_links *links;
+    int w;
+
+    // The energy of each position, if it was computed up front. Otherwise,
+    // the costs are computed from the image, one span at a time. Except with
+    // the forward energy, each span's energy goes through the scratch energy
+    // of the links, and is folded into the links right away.
+    const unsigned int *energy;
+    const struct image_view *img;
+    const unsigned char *luma;
+    enum carver_energy energy_function;
+
+    // The rows of the band, or the only row when splitting single rows.
+    int y0;
+    int y1;
+
+    int tile_columns;
+    int num_tiles;
+};
+
+static unsigned int pixel_distance(
+        const unsigned char *a,
+        const unsigned char *b) {
+    int dr = a[0] - b[0];
+    int dg = a[1] - b[1];
+    int db = a[2] - b[2];
+
+    return dr * dr + dg * dg + db * db;
+}
+
+static void compute_forward_seam_positions(
+        const unsigned char *pixels_above,
+        const unsigned char *pixels,
+        const unsigned int *prev_row,
+        int w,
+        int x,
+        int x1,
+        unsigned int *row,
+        signed char *parent_offsets) {
+    // The scalar version of `simd_forward_seam_row`, which also handles the
+    // first and last columns. The sentinels of `prev_row` can't be added to,
+    // so the candidates beyond the borders are left at UINT_MAX instead, and
+    // the left and right neighbors are clamped to the pixel itself.
+    for (int i = 0; x < x1; x++, i++) {
+        const unsigned char *left = pixels + (x == 0 ? x : x - 1) * 3;
+        const unsigned char *right = pixels + (x == w - 1 ? x : x + 1) * 3;
+        const unsigned char *above = pixels_above + x * 3;
+
+        unsigned int l = x == 0 ?
+            UINT_MAX :
+            prev_row[x - 1] + pixel_distance(above, left);
+        unsigned int c = prev_row[x];
+        unsigned int r = x == w - 1 ?
+            UINT_MAX :
+            prev_row[x + 1] + pixel_distance(above, right);
+
+        unsigned int m = l < c ? l : c;
+        m = r < m ? r : m;
+
+        row[i] = pixel_distance(left, right) + m;
+        parent_offsets[i] = l == m ? -1 : c == m ? 0 : 1;
+    }
+}
+
+static void compute_forward_seam_row(
+        const struct image_view *img,
+        const unsigned int *prev_row,
+        int y,
+        int x0,
+        int x1,
+        unsigned int *row,
+        signed char *parent_offsets) {
+    // Forward energy, from "Improved seam carving for video retargeting":
+    // instead of the energy of the removed pixel, each step costs the new
+    // edges created by bringing its neighbors together. Removing (x, y) joins
+    // its left and right neighbors, costing C_U. Coming from the upper left
+    // or upper right also brings the pixel above next to the left or right
+    // neighbor, adding C_L or C_R. The distances are the same squared color
+    // differences as the default gradient energy.
+    //
+    // The costs are computed straight from the image, so there is no
+    // separate energy pass.
+    int w = img->w;
+    const unsigned char *pixels = image_pixel(img, 0, y);
+    const unsigned char *pixels_above = image_pixel(img, 0, y - 1);
+
+    int x = x0;
+    if (x == 0 && x < x1) {
+        compute_forward_seam_positions(
+                pixels_above,
+                pixels,
+                prev_row,
+                w,
+                0,
+                1,
+                row,
+                parent_offsets);
+        x = 1;
+    }
+
+    x = simd_forward_seam_row(
+            pixels_above,
+            pixels,
+            prev_row,
+            w,
+            x,
+            x1,
+            row + (x - x0),
+            parent_offsets + (x - x0));
+
+    compute_forward_seam_positions(
+            pixels_above,
+            pixels,
+            prev_row,
+            w,
+            x,
+            x1,
+            row + (x - x0),
+            parent_offsets + (x - x0));
+}
+
+static void compute_vertical_seam_links_row(
+        const struct vertical_seam_links_band *band,
+        int y,
+        int x0,
+        int x1,
+        unsigned int *row,
+        signed char *parent_offsets) {
+    // Computes the links of row y in [x0, x1), into `row` and
+    // `parent_offsets` starting from x0, without touching the links
+    // themselves.
+    const struct seam_links *links = band->links;
+
+    if (band->energy) {
+        simd_seam_row(
+                seam_links_row(links, y - 1) + x0,
+                band->energy + y * links->stride + x0,
+                row,
+                parent_offsets,
+                x1 - x0);
+    } else if (band->energy_function == CARVER_FORWARD_ENERGY) {
+        compute_forward_seam_row(
+                band->img,
+                seam_links_row(links, y - 1),
+                y,
+                x0,
+                x1,
+                row,
+                parent_offsets);
+    } else {
+        // The energy is folded into the links a chunk at a time, while it's
+        // still in the L1 cache. The spans computed at the same time never
+        // share a column, so they can share the scratch energy.
+        unsigned int *energy_row = links->scratch_energy;
+        for (int cx0 = x0; cx0 < x1; cx0 += FUSED_ENERGY_CHUNK_COLUMNS) {
+            int cx1 = cx0 + FUSED_ENERGY_CHUNK_COLUMNS < x1 ?
+                cx0 + FUSED_ENERGY_CHUNK_COLUMNS : x1;
+
+            energy_span(
+                    band->energy_function,
+                    band->img,
+                    band->luma,
+                    y,
+                    cx0,
+                    cx1,
+                    energy_row);
+            simd_seam_row(
+                    seam_links_row(links, y - 1) + cx0,
+                    energy_row + cx0,
+                    row + (cx0 - x0),
+                    parent_offsets + (cx0 - x0),
+                    cx1 - cx0);
+        }
+    }
+}
+
+static void compute_vertical_seam_links_span(
+        const struct vertical_seam_links_band *band,
+        int y,
+        int x0,
+        int x1) {
+    // Computes the links in [x0, x1) and sets the parents of every byte fully
+    // within it, or ending at the last position of the row.
+    struct seam_links *links = band->links;
+    signed char *parent_offsets = links->scratch_parent_offsets;
+
+    compute_vertical_seam_links_row(
+            band,
+            y,
+            x0,
+            x1,
+            seam_links_row(links, y) + x0,
+            parent_offsets + x0);
+
+    // Whole bytes are packed at once, without reading them back first.
+    unsigned char *parents_row = seam_links_parents_row(links, y);
+    int parents_x0 = (x0 + 3) & ~3;
+    int parents_x1 = x1 == band->w ? x1 : x1 & ~3;
+    int x = parents_x0;
+    for (; x + 4 <= parents_x1; x += 4) {
+        parents_row[x / 4] =
+            (parent_offsets[x] + 1) |
+            (parent_offsets[x + 1] + 1) << 2 |
+            (parent_offsets[x + 2] + 1) << 4 |
+            (parent_offsets[x + 3] + 1) << 6;
+    }
+    for (; x < parents_x1; x++) {
+        set_parent_offset_at(parents_row, x, parent_offsets[x]);
+    }
+}
+
+static void compute_vertical_seam_links_chunk(void *context, int chunk) {
+    const struct vertical_seam_links_band *band = context;
+    int x0 = chunk * band->tile_columns;
+    int x1 = x0 + band->tile_columns;
+
+    compute_vertical_seam_links_span(
+            band,
+            band->y0,
+            x0,
+            x1 < band->w ? x1 : band->w);
+}
+
+static void compute_vertical_seam_links_trapezoid(void *context, int tile) {
+    const struct vertical_seam_links_band *band = context;
+    int x0 = tile * band->tile_columns;
+
+    // The last tile takes the leftover columns, so it's never narrower than
+    // the others.
+    int x1 = tile == band->num_tiles - 1 ? band->w : x0 + band->tile_columns;
+
+    // The trapezoid doesn't narrow on the sides of the image.
+    for (int y = band->y0; y < band->y1; y++) {
+        int inset = y - band->y0;
+        compute_vertical_seam_links_span(
+                band,
+                y,
+                tile > 0 ? x0 + inset : x0,
+                tile < band->num_tiles - 1 ? x1 - inset : x1);
+    }
+}
+
+static void compute_vertical_seam_links_triangle(void *context, int boundary) {
+    const struct vertical_seam_links_band *band = context;
+    struct seam_links *links = band->links;
+    int x = (boundary + 1) * band->tile_columns;
+
+    unsigned int row[2 * SEAM_LINKS_BAND_ROWS];
+    signed char parent_offsets[2 * SEAM_LINKS_BAND_ROWS];
+
+    for (int y = band->y0 + 1; y < band->y1; y++) {
+        // The triangle covers [x - inset, x + inset), and the bytes it shares
+        // with the trapezoids extend it to a multiple of 4 on both sides.
+        int inset = y - band->y0;
+        int x0 = x - ((inset + 3) & ~3);
+        int x1 = x + ((inset + 3) & ~3);
+
+        compute_vertical_seam_links_row(
+                band,
+                y,
+                x0,
+                x1,
+                row,
+                parent_offsets);
+
+        memcpy(
+                seam_links_row(links, y) + x - inset,
+                row + (x - inset - x0),
+                2 * inset * sizeof(unsigned int));
+
+        unsigned char *parents_row = seam_links_parents_row(links, y);
+        for (int i = 0; i < x1 - x0; i++) {
+            set_parent_offset_at(parents_row, x0 + i, parent_offsets[i]);
+        }
+    }
+}
+
+static void compute_vertical_seam_links_rows(
+        struct vertical_seam_links_band band,
+        int h,
+        struct thread_pool *pool) {
+    // Computes every row after the first, which must already be set.
+    struct seam_links *links = band.links;
+    int w = band.w;
+
+    int num_threads = thread_pool_num_threads(pool);
+    int band_rows = links->num_rows - 1 < SEAM_LINKS_BAND_ROWS ?
+        links->num_rows - 1 : SEAM_LINKS_BAND_ROWS;
+
+    if (num_threads > 1 &&
+            w / num_threads >= SEAM_LINKS_MIN_ROW_CHUNK_COLUMNS) {
+        band.tile_columns = ((w + num_threads - 1) / num_threads + 3) & ~3;
+        for (int y = 1; y < h; y++) {
+            band.y0 = y;
+            thread_pool_parallel_for(
+                    pool,
+                    (w + band.tile_columns - 1) / band.tile_columns,
+                    compute_vertical_seam_links_chunk,
+                    &band);
+        }
+    } else if (num_threads > 1 && band_rows > 1 &&
+            w >= 2 * SEAM_LINKS_MIN_TILE_COLUMNS) {
+        band.num_tiles = w / SEAM_LINKS_MIN_TILE_COLUMNS;
+        if (band.num_tiles > num_threads) { band.num_tiles = num_threads; }
+        band.tile_columns = (w / band.num_tiles) & ~3;
+
+        for (int y = 1; y < h; y += band_rows) {
+            band.y0 = y;
+            band.y1 = y + band_rows < h ? y + band_rows : h;
+            thread_pool_parallel_for(
+                    pool,
+                    band.num_tiles,
+                    compute_vertical_seam_links_trapezoid,
+                    &band);
+            thread_pool_parallel_for(
+                    pool,
+                    band.num_tiles - 1,
+                    compute_vertical_seam_links_triangle,
+                    &band);
+        }
+    } else {
+        for (int y = 1; y < h; y++) {
+            compute_vertical_seam_links_span(&band, y, 0, w);
+        }
+    }
+}
+
+static void set_vertical_seam_links_sentinels(
+        struct seam_links *links,
+        int w,
+        int h) {
+    for (int y = 0; y < h; y++) {
+        unsigned int *links_row = seam_links_row(links, y);
+        links_row[-1] = links_row[w] = UINT_MAX;
+    }
+}
+
+static void compute_vertical_seam_links(
+        struct seam_links *links,
+        const unsigned int *energy,
+        int w,
+        int h,
+        struct thread_pool *pool) {
+    set_vertical_seam_links_sentinels(links, w, h);
+    memcpy(seam_links_row(links, 0), energy, w * sizeof(unsigned int));
+
+    struct vertical_seam_links_band band = {
+        .links = links,
+        .w = w,
+        .energy = energy
+    };
+    compute_vertical_seam_links_rows(band, h, pool);
+}
+
+static void compute_fused_seam_links(
+        struct seam_links *links,
+        const struct image_view *img,
+        const unsigned char *luma,
+        enum carver_energy energy_function,
+        struct thread_pool *pool) {
+    // The links of vertical seams using a per-pixel energy, computing the
+    // energy of each span right before folding it into the links. The
+    // energy of the whole image is never written out and read back, saving
+    // 8 bytes of memory traffic per pixel. The links are identical to
+    // `compute_vertical_seam_links`.
+    set_vertical_seam_links_sentinels(links, img->w, img->h);
+    energy_span(
+            energy_function,
+            img,
+            luma,
+            0,
+            0,
+            img->w,
+            seam_links_row(links, 0));
+
+    struct vertical_seam_links_band band = {
+        .links = links,
+        .w = img->w,
+        .energy = NULL,
+        .img = img,
+        .luma = luma,
+        .energy_function = energy_function
+    };
+    compute_vertical_seam_links_rows(band, img->h, pool);
+}
+
+static void compute_forward_seam_links(
+        struct seam_links *links,
+        const struct image_view *img,
+        struct thread_pool *pool) {
+    // The links of vertical seams using forward energy. The first row has
+    // nothing above it, so it only costs joining each pixel's neighbors.
+    int w = img->w;
+    set_vertical_seam_links_sentinels(links, w, img->h);
+
+    unsigned int *first_row = seam_links_row(links, 0);
+    const unsigned char *pixels = image_pixel(img, 0, 0);
+    for (int x = 0; x < w; x++) {
+        first_row[x] = pixel_distance(
+                pixels + (x == 0 ? x : x - 1) * 3,
+                pixels + (x == w - 1 ? x : x + 1) * 3);
+    }
+
+    struct vertical_seam_links_band band = {
+        .links = links,
+        .w = w,
+        .energy = NULL,
+        .img = img,
+        .energy_function = CARVER_FORWARD_ENERGY
+    };
+    compute_vertical_seam_links_rows(band, img->h, pool);
+}
+
+// Horizontal seams are found one column at a time, each column of links
+// depending on the column to its left. Reading the energy one column at a
+// time would touch a new cache line for every pixel, so instead the energy is
+// read row by row, a strip of columns at a time, and transposed into a
+// scratch buffer holding each column of the strip contiguously. The links are
+// then computed column by column, with the same kernel as for vertical seams.
+#define HORIZONTAL_SEAM_STRIP 16
+
+static void compute_horizontal_seam_links(
+        struct seam_links *links,
+        const unsigned int *energy,
+        int energy_stride,
+        int w,
+        int h,
+        unsigned int *energy_columns) {
+    // Row x of the links corresponds to column x of the image. The links must
+    // have room for h positions and w rows, and `energy_columns` for
+    // HORIZONTAL_SEAM_STRIP * h energies.
+    signed char *parent_offsets = links->scratch_parent_offsets;
+
+    for (int x = 0; x < w; x++) {
+        unsigned int *links_row = seam_links_row(links, x);
+        links_row[-1] = links_row[h] = UINT_MAX;
+    }
+
+    for (int x0 = 0; x0 < w; x0 += HORIZONTAL_SEAM_STRIP) {
+        int strip_w = w - x0 < HORIZONTAL_SEAM_STRIP ?
+            w - x0 :
+            HORIZONTAL_SEAM_STRIP;
+
+        for (int y = 0; y < h; y++) {
+            const unsigned int *energy_row = energy + y * energy_stride + x0;
+            for (int i = 0; i < strip_w; i++) {
+                energy_columns[i * h + y] = energy_row[i];
+            }
+        }
+
+        for (int i = 0; i < strip_w; i++) {
+            int x = x0 + i;
+            const unsigned int *energy_column = energy_columns + i * h;
+
+            if (x == 0) {
+                memcpy(
+                        seam_links_row(links, 0),
+                        energy_column,
+                        h * sizeof(unsigned int));
+                continue;
+            }
+
+            simd_seam_row(
+                    seam_links_row(links, x - 1),
+                    energy_column,
+                    seam_links_row(links, x),
+                    parent_offsets,
+                    h);
+
+            unsigned char *parents_row = seam_links_parents_row(links, x);
+            for (int y = 0; y < h; y++) {
+                set_parent_offset_at(parents_row, y, parent_offsets[y]);
+            }
+        }
+    }
+}
+
+static long long vertical_seam_links_after_vertical_seam_removal(
+        struct seam_links *links,
+        const unsigned int *energy_after_removal,
+        const int *vertical_seam,
+        int w,
+        int h) {
+    // The links are first shifted in place, the same way as the image data.
+    // Because the parents are stored as offsets, they don't need to be
+    // adjusted for the removed column. After that, the only links that can
+    // differ from a full recomputation are:
+    //
+    // - The ones near the seam, where either the energy changed or the three
+    //   candidate parents are no longer the same pixels as before.
+    //
+    // - The ones below a link whose energy changed. This is the cone of
+    //   influence of the seam, widening by one column per row on each side.
+    //
+    // Each row is only recomputed within the hull of these two ranges, and
+    // the cone stops growing as soon as the recomputed energies match the old
+    // ones.
+    //
+    // The links must contain every row. They start out as w x h and end up
+    // as (w - 1) x h. Returns the number of links recomputed.
+
+    unsigned int *recomputed_row = links->scratch_energy;
+    signed char *parent_offsets = links->scratch_parent_offsets;
+
+    for (int y = 0; y < h; y++) {
+        int seamx = vertical_seam[h - 1 - y];
+        unsigned int *links_row = seam_links_row(links, y);
+
+        // Moving the right sentinel along with the rest of the row.
+        memmove(
+                links_row + seamx,
+                links_row + seamx + 1,
+                (w - seamx) * sizeof(unsigned int));
+        remove_parent_offset_at(seam_links_parents_row(links, y), seamx, w);
+    }
+
+    w--;
+
+    // The range of links whose energy changed in the previous row, or an
+    // empty range if none of them changed.
+    int changed_x0 = w;
+    int changed_x1 = -1;
+    long long num_recomputed = 0;
+
+    for (int y = 0; y < h; y++) {
+        int seamx = vertical_seam[h - 1 - y];
+
+        int x0 = seamx - 2;
+        int x1 = seamx + 1;
+        if (changed_x0 <= changed_x1) {
+            x0 = changed_x0 - 1 < x0 ? changed_x0 - 1 : x0;
+            x1 = changed_x1 + 1 > x1 ? changed_x1 + 1 : x1;
+        }
+        x0 = x0 < 0 ? 0 : x0;
+        x1 = x1 > w - 1 ? w - 1 : x1;
+        num_recomputed += x1 - x0 + 1;
+
+        unsigned int *links_row = seam_links_row(links, y);
+        unsigned char *parents_row = seam_links_parents_row(links, y);
+        const unsigned int *energy_row =
+            energy_after_removal + y * links->stride;
+
+        if (y == 0) {
+            memcpy(
+                    recomputed_row + x0,
+                    energy_row + x0,
+                    (x1 - x0 + 1) * sizeof(unsigned int));
+        } else {
+            simd_seam_row(
+                    seam_links_row(links, y - 1) + x0,
+                    energy_row + x0,
+                    recomputed_row + x0,
+                    parent_offsets + x0,
+                    x1 - x0 + 1);
+        }
+
+        changed_x0 = w;
+        changed_x1 = -1;
+
+        for (int x = x0; x <= x1; x++) {
+            if (recomputed_row[x] != links_row[x]) {
+                changed_x0 = x < changed_x0 ? x : changed_x0;
+                changed_x1 = x;
+            }
+
+            links_row[x] = recomputed_row[x];
+            if (y > 0) {
+                set_parent_offset_at(parents_row, x, parent_offsets[x]);
+            }
+        }
+    }
+
+    return num_recomputed;
+}
+
+static void backtrack_seam(
+        const struct seam_links *seam_links,
+        int seam_length,
+        int end_coordinate,
+        int *seam) {
+    int offset = end_coordinate;
+
+    for (int d = 0; d < seam_length; d++) {
+        seam[d] = offset;
+
+        if (d < seam_length - 1) {
+            const unsigned char *parents_row =
+                seam_links_parents_row(seam_links, seam_length - 1 - d);
+
+            offset += parent_offset_at(parents_row, offset);
+        }
+    }
+}
+
+static unsigned int get_minimal_seam(
+        const struct seam_links *seam_links,
+        int num_seams,
+        int seam_length,
+        int *minimal_seam) {
+    // Returns the total energy of the seam.
+
+    const unsigned int *last_row = seam_links_row(seam_links, seam_length - 1);
+
+    int min_coordinate = -1;
+    unsigned int min_energy = UINT_MAX;
+
+    for (int coordinate = 0; coordinate < num_seams; coordinate++) {
+        if (last_row[coordinate] < min_energy) {
+            min_coordinate = coordinate;
+            min_energy = last_row[coordinate];
+        }
+    }
+
+    backtrack_seam(seam_links, seam_length, min_coordinate, minimal_seam);
+
+    return min_energy;
+}
+
+struct seam_end {
+    unsigned int energy;
+    int coordinate;
+};
+
+static int compare_seam_ends(const void *a, const void *b) {
+    const struct seam_end *end_a = a;
+    const struct seam_end *end_b = b;
+
+    if (end_a->energy != end_b->energy) {
+        return end_a->energy < end_b->energy ? -1 : 1;
+    }
+
+    return end_a->coordinate - end_b->coordinate;
+}
+
+static int get_low_energy_vertical_seams(
+        const struct seam_links *seam_links,
+        int w,
+        int h,
+        int max_seams,
+        struct seam_end *seam_ends,
+        unsigned char *claimed,
+        int *seams,
+        unsigned long long *total_energy) {
+    // Finds up to `max_seams` vertical seams that don't share any pixels, in
+    // increasing order of energy, all from the same set of links. Returns the
+    // number of seams found, stored one after the other in `seams` and sorted
+    // from left to right.
+    //
+    // Every seam is backtracked along the same parent links, so two seams
+    // that touch merge from there on up. Such a seam is rejected, and since
+    // seams can't cross without touching, the remaining seams never cross
+    // either. This is only an approximation of removing the seams one at a
+    // time, since the seams after the first are not recomputed on the image
+    // with the previous seams removed.
+    //
+    // `seam_ends` must have room for w entries, and `claimed` must have room
+    // for the links' stride times h entries, all zero. `claimed` is left all
+    // zero on return.
+
+    const unsigned int *last_row = seam_links_row(seam_links, h - 1);
+    int stride = seam_links->stride;
+
+    for (int x = 0; x < w; x++) {
+        seam_ends[x] = (struct seam_end) {
+            .energy = last_row[x],
+            .coordinate = x
+        };
+    }
+    qsort(seam_ends, w, sizeof(struct seam_end), compare_seam_ends);
+
+    int num_seams = 0;
+    *total_energy = 0;
+
+    for (int candidate = 0; candidate < w && num_seams < max_seams;
+            candidate++) {
+        int *seam = seams + num_seams * h;
+        int x = seam_ends[candidate].coordinate;
+        int d = 0;
+
+        for (; d < h; d++) {
+            int y = h - 1 - d;
+            if (claimed[y * stride + x]) { break; }
+
+            seam[d] = x;
+            if (d < h - 1) {
+                const unsigned char *parents_row =
+                    seam_links_parents_row(seam_links, y);
+                x += parent_offset_at(parents_row, x);
+            }
+        }
+
+        if (d < h) { continue; }
+
+        for (d = 0; d < h; d++) {
+            claimed[(h - 1 - d) * stride + seam[d]] = 1;
+        }
+
+        *total_energy += seam_ends[candidate].energy;
+        num_seams++;
+    }
+
+    for (int i = 0; i < num_seams; i++)
+    for (int d = 0; d < h; d++) {
+        claimed[(h - 1 - d) * stride + seams[i * h + d]] = 0;
+    }
+
+    // Since the seams never cross, ordering them by their position in any one
+    // row orders them in every row.
+    for (int i = 1; i < num_seams; i++)
+    for (int j = i; j > 0 && seams[(j - 1) * h] > seams[j * h]; j--)
+    for (int d = 0; d < h; d++) {
+        int tmp = seams[(j - 1) * h + d];
+        seams[(j - 1) * h + d] = seams[j * h + d];
+        seams[j * h + d] = tmp;
+    }
+
+    return num_seams;
+}
+
+// REMOVAL ////////////////////////////////////////////////////////////////////
+
+static void remove_vertical_seams_from_rows(
+        unsigned char *data,
+        int element_size,
+        int stride,
+        int w,
+        int h,
+        const int *vertical_seams,
+        int num_seams) {
+    // Removes one or more vertical seams in a single pass over each row,
+    // shifting only the elements to the right of the first seam, in place.
+    // The seams must not cross or touch, and must be sorted from left to
+    // right.
+    for (int y = 0; y < h; y++) {
+        unsigned char *row = data + y * stride * element_size;
+        int dst = vertical_seams[h - 1 - y];
+
+        for (int i = 0; i < num_seams; i++) {
+            int src = vertical_seams[i * h + h - 1 - y] + 1;
+            int src_end =
+                i + 1 < num_seams ? vertical_seams[(i + 1) * h + h - 1 - y] :
+                w;
+
+            memmove(
+                    row + dst * element_size,
+                    row + src * element_size,
+                    (src_end - src) * element_size);
+            dst += src_end - src;
+        }
+    }
+}
+
+static void remove_vertical_seams(
+        struct image_view *img,
+        const int *vertical_seams,
+        int num_seams) {
+    remove_vertical_seams_from_rows(
+            img->data,
+            3,
+            img->stride,
+            img->w,
+            img->h,
+            vertical_seams,
+            num_seams);
+
+    img->w -= num_seams;
+}
+
+static void remove_horizontal_seam_from_rows(
+        unsigned char *data,
+        int element_size,
+        int stride,
+        int w,
+        int h,
+        const int *horizontal_seam) {
+    // Moves every element below the seam up by one row. Going row by row
+    // keeps the accesses sequential: in each row, the elements at or below
+    // the seam form runs of columns, since the seam moves by at most one row
+    // from one column to the next, and each run is copied up from the row
+    // below.
+    for (int y = 0; y < h - 1; y++) {
+        unsigned char *row = data + y * stride * element_size;
+        const unsigned char *row_below = row + stride * element_size;
+
+        for (int x = 0; x < w;) {
+            if (horizontal_seam[w - 1 - x] > y) {
+                x++;
+                continue;
+            }
+
+            int run_end = x + 1;
+            while (run_end < w && horizontal_seam[w - 1 - run_end] <= y) {
+                run_end++;
+            }
+
+            memcpy(
+                    row + x * element_size,
+                    row_below + x * element_size,
+                    (run_end - x) * element_size);
+            x = run_end;
+        }
+    }
+}
+
+static void remove_horizontal_seam(
+        struct image_view *img,
+        const int *horizontal_seam) {
+    remove_horizontal_seam_from_rows(
+            img->data,
+            3,
+            img->stride,
+            img->w,
+            img->h,
+            horizontal_seam);
+
+    img->h--;
+}
+
+static void compact_rows(
+        unsigned char *data,
+        int element_size,
+        int stride,
+        int w,
+        int h) {
+    // Moves the rows next to each other, so the stride matches the width.
+    for (int y = 1; y < h; y++) {
+        memmove(
+                data + y * w * element_size,
+                data + y * stride * element_size,
+                w * element_size);
+    }
+}
+
+static void compact_image(struct image_view *img) {
+    compact_rows(img->data, 3, img->stride, img->w, img->h);
+    img->stride = img->w;
+}
+
+static void energy_after_vertical_seam_removal(
+        enum carver_energy energy_function,
+        unsigned int *energy,
+        const struct image_view *img_after_removal,
+        const unsigned char *luma_after_removal,
+        const int *vertical_seam) {
+    // With the energies supporting incremental carving, removing a vertical
+    // seam only changes the energy of the pixels that end up directly next to
+    // the seam: every other pixel keeps the same left, right, top and bottom
+    // neighbors, since the seams in adjacent rows are at most one column
+    // apart. The existing energies are shifted in place, the
+    // same way as the image data, then only the two pixels bordering the seam
+    // in each row are re-evaluated.
+
+    int w = img_after_removal->w;
+    int h = img_after_removal->h;
+    int stride = img_after_removal->stride;
+
+    for (int y = 0; y < h; y++) {
+        int seamx = vertical_seam[h - 1 - y];
+        unsigned int *energy_row = energy + y * stride;
+
+        memmove(
+                energy_row + seamx,
+                energy_row + seamx + 1,
+                (w - seamx) * sizeof(unsigned int));
+
+        int x = seamx == 0 ? seamx : seamx - 1;
+        int x_end = seamx == w ? seamx - 1 : seamx;
+        energy_span(
+                energy_function,
+                img_after_removal,
+                luma_after_removal,
+                y,
+                x,
+                x_end + 1,
+                energy_row);
+    }
+}
+
+// PYRAMID ////////////////////////////////////////////////////////////////////
+
+// On very large images, the seams can be found coarse to fine instead of
+// running the DP over the whole image for every seam. Level 0 is the image
+// itself, and each following level halves the width and the height of the
+// one below, averaging each block of 2x2 pixels. The minimal seam of the
+// coarsest level is found as usual. Each finer level then only runs the DP
+// inside a corridor around the seam of the level above: the two columns
+// covered by each coarse column, plus `corridor_radius` columns on each side.
+// A seam then costs about w h / 4^levels + h r instead of w h, but is only
+// approximately minimal.
+//
+// Downsampling the image again after every seam would cost a pass over the
+// whole image. Instead, level k removes its own seam once every 2^k seams,
+// which keeps its width at about the width of the image over 2^k, and the
+// levels are rebuilt from the image every PYRAMID_REBUILD_SEAMS seams, before
+// they drift too far from it.
+
+#define PYRAMID_MAX_LEVELS 8
+#define PYRAMID_REBUILD_SEAMS 32
+
+// The number of coarse rows downsampled per task.
+#define PYRAMID_BAND_ROWS 16
+
+struct pyramid_level {
+    // Allocated for the original size of the image, halved once per level,
+    // and shrinking as seams are removed, like the image.
+    struct image_view img;
+    unsigned char *luma;
+
+    // The seam found at this level by the last search.
+    int *seam;
+};
+
+struct pyramid {
+    // The requested number of levels above the image, or 0 when the seams
+    // are found with the full DP.
+    int num_levels;
+    int corridor_radius;
+
+    // The number of levels in use since the last rebuild, which is lower for
+    // small images, or -1 when the levels must be rebuilt before the next
+    // search.
+    int active_levels;
+    int seams_since_rebuild;
+
+    // Level 0 is unused, the image itself taking its place.
+    struct pyramid_level levels[PYRAMID_MAX_LEVELS + 1];
+
+    // The seam links of the coarsest level.
+    struct seam_links links;
+
+    // For each row of the current level, the first column of the corridor,
+    // the parent offsets of every column in the corridor, and the minimal
+    // energies of the previous and current rows of the corridor.
+    int *corridor_x0;
+    signed char *corridor_parents;
+    unsigned int *corridor_energies;
+};
+
+static int corridor_columns(const struct pyramid *pyramid) {
+    return 2 * pyramid->corridor_radius + 2;
+}
+
+static int pyramid_level_fits(int w, int h) {
+    // Each level must stay wide enough to lose one column every 2^k seams
+    // until the next rebuild.
+    return w >= PYRAMID_REBUILD_SEAMS && h >= 2;
+}
+
+struct downsample_bands {
+    const struct image_view *src;
+    const struct image_view *dst;
+};
+
+static void downsample_band(void *context, int band) {
+    const struct downsample_bands *bands = context;
+    const struct image_view *src = bands->src;
+    const struct image_view *dst = bands->dst;
+
+    int y1 = (band + 1) * PYRAMID_BAND_ROWS;
+    if (y1 > dst->h) { y1 = dst->h; }
+
+    for (int y = band * PYRAMID_BAND_ROWS; y < y1; y++) {
+        const unsigned char *top = image_pixel(src, 0, 2 * y);
+        const unsigned char *bottom = image_pixel(src, 0, 2 * y + 1);
+        unsigned char *row = image_pixel(dst, 0, y);
+
+        for (int i = 0; i < dst->w * 3; i++) {
+            // The same channel of the next pixel is 3 bytes further.
+            int x = i / 3 * 6 + i % 3;
+            row[i] = (top[x] + top[x + 3] + bottom[x] + bottom[x + 3] + 2) >> 2;
+        }
+    }
+}
+
+static void downsample_image(
+        const struct image_view *src,
+        struct image_view *dst,
+        struct thread_pool *pool) {
+    // An odd last row or column is left out.
+    dst->w = src->w / 2;
+    dst->h = src->h / 2;
+
+    struct downsample_bands bands = { .src = src, .dst = dst };
+    thread_pool_parallel_for(
+            pool,
+            (dst->h + PYRAMID_BAND_ROWS - 1) / PYRAMID_BAND_ROWS,
+            downsample_band,
+            &bands);
+}
+
+static void rebuild_pyramid(
+        struct pyramid *pyramid,
+        const struct image_view *img,
+        struct thread_pool *pool) {
+    // The image only gets smaller, so every level fitting the current image
+    // also fit the original one, and was allocated.
+    pyramid->active_levels = 0;
+    pyramid->seams_since_rebuild = 0;
+
+    const struct image_view *src = img;
+    for (int k = 1; k <= pyramid->num_levels; k++) {
+        if (!pyramid_level_fits(src->w / 2, src->h / 2)) { break; }
+
+        struct pyramid_level *level = &pyramid->levels[k];
+        downsample_image(src, &level->img, pool);
+        if (level->luma) {
+            energy_luma_rows(&level->img, 0, level->img.h, level->luma);
+        }
+
+        pyramid->active_levels = k;
+        src = &level->img;
+    }
+}
+
+static void pyramid_after_vertical_seam_removal(struct pyramid *pyramid) {
+    // Removes the seam found at each level whose turn it is, after the seam
+    // of the image itself was removed.
+    pyramid->seams_since_rebuild++;
+
+    for (int k = 1; k <= pyramid->active_levels; k++) {
+        if (pyramid->seams_since_rebuild % (1 << k) != 0) { continue; }
+
+        struct pyramid_level *level = &pyramid->levels[k];
+        if (level->luma) {
+            remove_vertical_seams_from_rows(
+                    level->luma,
+                    1,
+                    level->img.stride,
+                    level->img.w,
+                    level->img.h,
+                    level->seam,
+                    1);
+        }
+        remove_vertical_seams(&level->img, level->seam, 1);
+    }
+}
+
+static unsigned int find_corridor_seam(
+        const struct pyramid *pyramid,
+        const struct image_view *img,
+        const unsigned char *luma,
+        enum carver_energy energy_function,
+        const int *coarse_seam,
+        int coarse_h,
+        unsigned int *energy_row,
+        int *seam) {
+    // Finds the minimal seam of `img` among the seams staying inside the
+    // corridor around `coarse_seam`, found on the level above. `energy_row`
+    // is scratch space for one row of energies, indexed by column. Returns
+    // the total energy of the seam.
+    //
+    // The corridor of each odd row is centered between the coarse seam's
+    // positions above and below it, so the corridor only moves by one column
+    // per row, like a seam. Every position then has a parent in the corridor
+    // of the row above, and each row is a plain row of seam links. Ties go to
+    // the leftmost parent, as with the full DP.
+    int w = img->w;
+    int h = img->h;
+    int r = pyramid->corridor_radius;
+    int columns = corridor_columns(pyramid);
+
+    // Each row of minimal energies is padded with two sentinel columns of
+    // UINT_MAX on each side, since a corridor may start one column before the
+    // one above, and `simd_seam_row` reads one more column on each side.
+    unsigned int *prev_row = pyramid->corridor_energies + 2;
+    unsigned int *row = prev_row + columns + 4;
+    int prev_x0 = 0;
+    int prev_x1 = 0;
+
+    for (int y = 0; y < h; y++) {
+        int above = y / 2 < coarse_h ? y / 2 : coarse_h - 1;
+        int below = (y + 1) / 2 < coarse_h ? (y + 1) / 2 : coarse_h - 1;
+        int center =
+            coarse_seam[coarse_h - 1 - above] +
+            coarse_seam[coarse_h - 1 - below];
+        if (center > w - 1) { center = w - 1; }
+
+        int x0 = center - r > 0 ? center - r : 0;
+        int x1 = center + 2 + r < w ? center + 2 + r : w;
+
+        energy_span(energy_function, img, luma, y, x0, x1, energy_row);
+
+        if (y == 0) {
+            memcpy(row, energy_row + x0, (x1 - x0) * sizeof(unsigned int));
+        } else {
+            simd_seam_row(
+                    prev_row + x0 - prev_x0,
+                    energy_row + x0,
+                    row,
+                    pyramid->corridor_parents + y * columns,
+                    x1 - x0);
+        }
+
+        row[-2] = row[-1] = UINT_MAX;
+        row[x1 - x0] = row[x1 - x0 + 1] = UINT_MAX;
+        pyramid->corridor_x0[y] = x0;
+
+        unsigned int *swap = prev_row;
+        prev_row = row;
+        row = swap;
+        prev_x0 = x0;
+        prev_x1 = x1;
+    }
+
+    int x = prev_x0;
+    for (int i = prev_x0; i < prev_x1; i++) {
+        if (prev_row[i - prev_x0] < prev_row[x - prev_x0]) { x = i; }
+    }
+    unsigned int energy = prev_row[x - prev_x0];
+
+    for (int y = h - 1; y >= 0; y--) {
+        seam[h - 1 - y] = x;
+
+        if (y > 0) {
+            const signed char *parents =
+                pyramid->corridor_parents + y * columns;
+            x += parents[x - pyramid->corridor_x0[y]];
+        }
+    }
+
+    return energy;
+}
+
+static void compute_pyramid_seam_links(
+        struct pyramid *pyramid,
+        enum carver_energy energy_function,
+        struct thread_pool *pool) {
+    // The full seam links of the coarsest level.
+    const struct pyramid_level *level =
+        &pyramid->levels[pyramid->active_levels];
+
+    compute_fused_seam_links(
+            &pyramid->links,
+            &level->img,
+            level->luma,
+            energy_function,
+            pool);
+}
+
+static unsigned int find_pyramid_seam(
+        struct pyramid *pyramid,
+        const struct image_view *img,
+        const unsigned char *luma,
+        enum carver_energy energy_function,
+        unsigned int *energy_row,
+        int *seam) {
+    // Must be called after `compute_pyramid_seam_links`. Refines the minimal
+    // seam of the coarsest level down to the image, into `seam`. Returns the
+    // total energy of the seam.
+    int k = pyramid->active_levels;
+    struct pyramid_level *coarsest = &pyramid->levels[k];
+    get_minimal_seam(
+            &pyramid->links,
+            coarsest->img.w,
+            coarsest->img.h,
+            coarsest->seam);
+
+    unsigned int energy = 0;
+    for (k--; k >= 0; k--) {
+        const struct pyramid_level *coarse = &pyramid->levels[k + 1];
+        struct pyramid_level *level = &pyramid->levels[k];
+
+        energy = find_corridor_seam(
+                pyramid,
+                k == 0 ? img : &level->img,
+                k == 0 ? luma : level->luma,
+                energy_function,
+                coarse->seam,
+                coarse->img.h,
+                energy_row,
+                k == 0 ? seam : level->seam);
+    }
+
+    return energy;
+}
+
+// CARVER /////////////////////////////////////////////////////////////////////
+
+struct carver {
+    struct image_view img;
+
+    // Shared with the rest of the program, and may be NULL.
+    struct thread_pool *pool;
+    struct trace *trace;
+
+    enum carver_energy energy_function;
+
+    // When set, the energy and the vertical seam links are kept up to date
+    // as seams are removed, instead of being recomputed on every iteration.
+    int incremental;
+
+    // The maximum number of seams removed on each iteration. More than one
+    // seam per iteration is an approximation, trading quality for speed.
+    int seams_per_pass;
+
+    // The levels used to find the vertical seams coarse to fine, when
+    // `pyramid.num_levels` is set. Their buffers are in the arena too.
+    struct pyramid pyramid;
+
+    // Called right before each iteration's seams are removed, if set.
+    carver_iteration_callback callback;
+    void *callback_context;
+
+    // Holds every buffer below. The buffers are allocated once, for the
+    // original size of the image, and reused on every iteration.
+    struct arena arena;
+
+    // Only allocated for the energies using the brightness. The brightness
+    // of each remaining pixel, kept up to date along with the image as seams
+    // are removed, using the same stride as the image.
+    unsigned char *luma;
+
+    // Not allocated for the forward energy. The energy of the whole image
+    // is only kept by incremental carvers, and computed for horizontal seams
+    // and visualizations. Vertical seams are otherwise found computing the
+    // energy one span at a time, along with the seam links.
+    unsigned int *energy;
+
+    struct seam_links vertical_seam_links;
+    int *vertical_seams;
+
+    // Only allocated when removing more than one seam per iteration.
+    struct seam_end *seam_ends;
+    unsigned char *claimed;
+
+    // Used when removing horizontal seams, which are always found one at a
+    // time, from scratch, and never with the forward energy.
+    struct seam_links horizontal_seam_links;
+    int *horizontal_seam;
+    unsigned int *energy_columns;
+
+    // The number of iterations run so far, used to number the seam frames.
+    int num_iterations;
+
+    // The sum of the energies of every seam removed so far.
+    unsigned long long total_seam_energy;
+    int num_seams_removed;
+
+    // Only allocated when tracking the order in which pixels are removed.
+    // For each remaining pixel, the X coordinate of that pixel in the
+    // original image, using the same stride as the image. For each pixel of
+    // the original image, the index of the seam that removed it, or UINT_MAX.
+    unsigned int *original_x;
+    unsigned int *removal_order;
+};
+
+// The stages below are timed in the carver's trace, if any, as part of the
+// given iteration.
+
+static void compute_energy_traced(
+        struct carver *carver,
+        const struct image_view *img,
+        const unsigned char *luma,
+        int iteration) {
+    unsigned long long start = trace_begin(carver->trace);
+    compute_energy(
+            img,
+            luma,
+            carver->energy_function,
+            carver->energy,
+            carver->pool);
+    trace_end(
+            carver->trace,
+            TRACE_ENERGY,
+            iteration,
+            start,
+            (long long) img->w * img->h,
+            0);
+}
+
+static void compute_vertical_seam_links_traced(
+        struct carver *carver,
+        const struct image_view *img,
+        const unsigned char *luma,
+        int iteration) {
+    unsigned long long start = trace_begin(carver->trace);
+    if (carver->energy_function == CARVER_FORWARD_ENERGY) {
+        compute_forward_seam_links(
+                &carver->vertical_seam_links,
+                img,
+                carver->pool);
+    } else if (carver->incremental) {
+        compute_vertical_seam_links(
+                &carver->vertical_seam_links,
+                carver->energy,
+                img->w,
+                img->h,
+                carver->pool);
+    } else {
+        compute_fused_seam_links(
+                &carver->vertical_seam_links,
+                img,
+                luma,
+                carver->energy_function,
+                carver->pool);
+    }
+    trace_end(
+            carver->trace,
+            TRACE_SEAM_LINKS,
+            iteration,
+            start,
+            (long long) img->w * img->h,
+            0);
+}
+
+static void compute_horizontal_seam_links_traced(
+        struct carver *carver,
+        const struct image_view *img,
+        int iteration) {
+    unsigned long long start = trace_begin(carver->trace);
+    compute_horizontal_seam_links(
+            &carver->horizontal_seam_links,
+            carver->energy,
+            img->stride,
+            img->w,
+            img->h,
+            carver->energy_columns);
+    trace_end(
+            carver->trace,
+            TRACE_SEAM_LINKS,
+            iteration,
+            start,
+            (long long) img->w * img->h,
+            0);
+}
+
+static int prepare_pyramid_traced(struct carver *carver, int iteration) {
+    // Rebuilds the pyramid when due, and computes the seam links of its
+    // coarsest level. Returns whether the next seam is found with the
+    // pyramid.
+    struct pyramid *pyramid = &carver->pyramid;
+    if (pyramid->num_levels == 0) { return 0; }
+
+    if (pyramid->active_levels < 0 ||
+            pyramid->seams_since_rebuild == PYRAMID_REBUILD_SEAMS) {
+        unsigned long long start = trace_begin(carver->trace);
+        rebuild_pyramid(pyramid, &carver->img, carver->pool);
+        trace_end(
+                carver->trace,
+                TRACE_PYRAMID,
+                iteration,
+                start,
+                (long long) carver->img.w * carver->img.h,
+                0);
+    }
+
+    if (pyramid->active_levels == 0) { return 0; }
+
+    const struct image_view *coarsest =
+        &pyramid->levels[pyramid->active_levels].img;
+
+    unsigned long long start = trace_begin(carver->trace);
+    compute_pyramid_seam_links(pyramid, carver->energy_function, carver->pool);
+    trace_end(
+            carver->trace,
+            TRACE_SEAM_LINKS,
+            iteration,
+            start,
+            (long long) coarsest->w * coarsest->h,
+            0);
+
+    return 1;
+}
+
+static void allocate_carver_buffers(
+        struct carver *carver,
+        int track_removal_order) {
+    // Horizontal seams are found on the same image, with the width and the
+    // height swapped.
+    struct arena *arena = &carver->arena;
+    int w = carver->img.w;
+    int h = carver->img.h;
+    size_t num_pixels = (size_t) w * h;
+
+    int per_pixel = carver->energy_function != CARVER_FORWARD_ENERGY;
+
+    if (energy_uses_luma(carver->energy_function)) {
+        carver->luma = arena_allocate(arena, num_pixels);
+    }
+
+    if (per_pixel) {
+        carver->energy =
+            arena_allocate(arena, num_pixels * sizeof(unsigned int));
+    }
+
+    allocate_seam_links(
+            &carver->vertical_seam_links,
+            arena,
+            w,
+            h,
+            carver->incremental ? h : SEAM_LINKS_BAND_ROWS + 1);
+    carver->vertical_seams = arena_allocate(
+            arena,
+            (size_t) carver->seams_per_pass * h * sizeof(int));
+
+    if (carver->seams_per_pass > 1) {
+        carver->seam_ends = arena_allocate(arena, w * sizeof(struct seam_end));
+        carver->claimed = arena_allocate(arena, num_pixels);
+    }
+
+    if (per_pixel) {
+        allocate_seam_links(&carver->horizontal_seam_links, arena, h, w, 2);
+        carver->horizontal_seam = arena_allocate(arena, w * sizeof(int));
+        carver->energy_columns = arena_allocate(
+                arena,
+                HORIZONTAL_SEAM_STRIP * h * sizeof(unsigned int));
+    }
+
+    struct pyramid *pyramid = &carver->pyramid;
+    for (int k = 1; k <= pyramid->num_levels; k++) {
+        int level_w = w >> k;
+        int level_h = h >> k;
+        if (!pyramid_level_fits(level_w, level_h)) { break; }
+
+        struct pyramid_level *level = &pyramid->levels[k];
+        level->img = (struct image_view) {
+            .data = arena_allocate(arena, (size_t) level_w * level_h * 3),
+            .w = level_w,
+            .h = level_h,
+            .stride = level_w
+        };
+        if (energy_uses_luma(carver->energy_function)) {
+            level->luma = arena_allocate(arena, (size_t) level_w * level_h);
+        }
+        level->seam = arena_allocate(arena, level_h * sizeof(int));
+
+        if (k == 1) {
+            // Any level may end up the coarsest one, and the first is the
+            // largest.
+            allocate_seam_links(
+                    &pyramid->links,
+                    arena,
+                    level_w,
+                    level_h,
+                    SEAM_LINKS_BAND_ROWS + 1);
+            pyramid->corridor_x0 = arena_allocate(arena, h * sizeof(int));
+            pyramid->corridor_parents =
+                arena_allocate(arena, (size_t) h * corridor_columns(pyramid));
+            pyramid->corridor_energies = arena_allocate(
+                    arena,
+                    2 * (corridor_columns(pyramid) + 4) * sizeof(unsigned int));
+        }
+    }
+
+    if (track_removal_order) {
+        carver->original_x =
+            arena_allocate(arena, num_pixels * sizeof(unsigned int));
+        carver->removal_order =
+            arena_allocate(arena, num_pixels * sizeof(unsigned int));
+    }
+}
+
+void carver_free(struct carver *carver) {
+    if (!carver) { return; }
+
+    if (carver->arena.data) { free(carver->arena.data); }
+    free(carver);
+}
+
+struct carver * carver_create(
+        unsigned char *data,
+        int w,
+        int h,
+        enum carver_energy energy,
+        int incremental,
+        int seams_per_pass,
+        int pyramid_levels,
+        int corridor_radius,
+        int track_removal_order,
+        struct thread_pool *pool,
+        struct trace *trace) {
+    unsigned long long start = trace_begin(trace);
+
+    if (seams_per_pass < 1) {
+        fprintf(
+                stderr,
+                "Invalid number of seams per pass: %d\n",
+                seams_per_pass);
+        return NULL;
+    }
+
+    // The incremental updates only handle one removed seam per iteration.
+    if (incremental && seams_per_pass > 1) {
+        fprintf(
+                stderr,
+                "Incremental carving can't be combined with more than one "
+                "seam per iteration\n");
+        return NULL;
+    }
+
+    if (pyramid_levels < 0 ||
+            pyramid_levels > PYRAMID_MAX_LEVELS ||
+            corridor_radius < 0) {
+        fprintf(
+                stderr,
+                "Invalid pyramid of %d levels with a corridor radius of %d\n",
+                pyramid_levels,
+                corridor_radius);
+        return NULL;
+    }
+
+    // The pyramid finds one seam at a time, from scratch, with an energy per
+    // pixel.
+    if (pyramid_levels > 0 &&
+            (incremental ||
+             seams_per_pass > 1 ||
+             energy == CARVER_FORWARD_ENERGY)) {
+        fprintf(
+                stderr,
+                "A pyramid can't be combined with incremental carving, more "
+                "than one seam per iteration or the forward energy\n");
+        return NULL;
+    }
+
+    // The cumulative energies of the seams are unsigned ints.
+    if (h > energy_max_seam_length(energy)) {
+        fprintf(
+                stderr,
+                "The %s energy only supports images up to %d pixels tall\n",
+                carver_energy_name(energy),
+                energy_max_seam_length(energy));
+        return NULL;
+    }
+
+    // The incremental updates rely on the energy of each pixel only
+    // depending on its immediate neighbors, which is only the case for some
+    // of the energies.
+    if (incremental && !carver_energy_is_incremental(energy)) {
+        fprintf(
+                stderr,
+                "The %s energy can't be updated incrementally\n",
+                carver_energy_name(energy));
+        return NULL;
+    }
+
+    struct carver *carver = calloc(1, sizeof(struct carver));
+    if (!carver) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return NULL;
+    }
+
+    carver->img = (struct image_view) {
+        .data = data,
+        .w = w,
+        .h = h,
+        .stride = w
+    };
+    carver->pool = pool;
+    carver->trace = trace;
+    carver->energy_function = energy;
+    carver->incremental = incremental;
+    carver->seams_per_pass = seams_per_pass;
+    carver->pyramid.num_levels = pyramid_levels;
+    // A wider corridor would cover the whole image anyway.
+    carver->pyramid.corridor_radius = corridor_radius < w ? corridor_radius : w;
+    carver->pyramid.active_levels = -1;
+
+    // The first pass only measures the arena. The block is zeroed, which the
+    // packed parents and the claimed pixels rely on.
+    allocate_carver_buffers(carver, track_removal_order);
+
+    carver->arena.size = carver->arena.used;
+    carver->arena.used = 0;
+    carver->arena.data = calloc(carver->arena.size, 1);
+    if (!carver->arena.data) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        carver_free(carver);
+        return NULL;
+    }
+
+    allocate_carver_buffers(carver, track_removal_order);
+
+    if (carver->luma) {
+        energy_luma_rows(&carver->img, 0, h, carver->luma);
+    }
+
+    if (track_removal_order) {
+        for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            carver->original_x[y * w + x] = x;
+            carver->removal_order[y * w + x] = UINT_MAX;
+        }
+    }
+
+    if (incremental) {
+        compute_energy_traced(carver, &carver->img, carver->luma, -1);
+        compute_vertical_seam_links_traced(
+                carver,
+                &carver->img,
+                carver->luma,
+                -1);
+    }
+
+    trace_end(
+            trace,
+            TRACE_SETUP,
+            -1,
+            start,
+            (long long) w * h,
+            sizeof(struct carver) + carver->arena.size);
+
+    return carver;
+}
+
+static int check_seam_counts(
+        const struct carver *carver,
+        int num_vertical_seams,
+        int num_horizontal_seams) {
+    // At least one column and one row are always left. Returns non-zero if
+    // the image is too small for the seams.
+    if (num_vertical_seams < 0 || num_vertical_seams >= carver->img.w) {
+        fprintf(
+                stderr,
+                "Unable to remove %d vertical seams from a %d pixel wide "
+                "image\n",
+                num_vertical_seams,
+                carver->img.w);
+        return 1;
+    }
+
+    if (num_horizontal_seams < 0 || num_horizontal_seams >= carver->img.h) {
+        fprintf(
+                stderr,
+                "Unable to remove %d horizontal seams from a %d pixel tall "
+                "image\n",
+                num_horizontal_seams,
+                carver->img.h);
+        return 1;
+    }
+
+    // Horizontal seams run across the whole width, which their cumulative
+    // energies must fit, like the height does for vertical seams.
+    if (num_horizontal_seams > 0 &&
+            carver->img.w > energy_max_seam_length(carver->energy_function)) {
+        fprintf(
+                stderr,
+                "The %s energy only supports horizontal seams in images up "
+                "to %d pixels wide\n",
+                carver_energy_name(carver->energy_function),
+                energy_max_seam_length(carver->energy_function));
+        return 1;
+    }
+
+    return 0;
+}
+
+static int check_horizontal_seams_untracked(
+        const struct carver *carver,
+        int num_horizontal_seams) {
+    // The removal order only maps each pixel to the vertical seam that
+    // removed it. Returns non-zero if horizontal seams would be removed while
+    // it is tracked.
+    if (num_horizontal_seams > 0 && carver->removal_order) {
+        fprintf(
+                stderr,
+                "Horizontal seams can't be removed while tracking the removal "
+                "order\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static void record_removed_vertical_seams(
+        struct carver *carver,
+        const int *vertical_seams,
+        int num_seams) {
+    // Must be called right before the seams are removed from the image.
+    const struct image_view *img = &carver->img;
+
+    if (carver->removal_order) {
+        for (int i = 0; i < num_seams; i++)
+        for (int y = 0; y < img->h; y++) {
+            int x = vertical_seams[i * img->h + img->h - 1 - y];
+            unsigned int original_x = carver->original_x[y * img->stride + x];
+
+            carver->removal_order[y * img->stride + original_x] =
+                carver->num_seams_removed + i;
+        }
+
+        remove_vertical_seams_from_rows(
+                (unsigned char *) carver->original_x,
+                sizeof(unsigned int),
+                img->stride,
+                img->w,
+                img->h,
+                vertical_seams,
+                num_seams);
+    }
+
+    carver->num_seams_removed += num_seams;
+}
+
+// ORDER //////////////////////////////////////////////////////////////////////
+
+// When removing both vertical and horizontal seams, the order in which they
+// are removed changes the total energy removed. The order is found up front,
+// on copies of the image, and the seams are then removed in that order as
+// usual.
+
+// The most memory the copies of the image kept while finding the optimal
+// order may take.
+#define ORDER_MAX_SLOTS_BYTES (1ULL << 30)
+
+static int check_not_incremental(const struct carver *carver) {
+    // Seam orders remove seams in both directions, one at a time from
+    // scratch, while incremental carvers only keep their energy and seam
+    // links up to date for vertical seams. Returns non-zero for incremental
+    // carvers.
+    if (carver->incremental) {
+        fprintf(stderr, "Seam orders can't be used with incremental carving\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static unsigned int find_minimal_seam(
+        struct carver *carver,
+        const struct image_view *img,
+        unsigned char *luma,
+        enum seam_direction direction,
+        int *seam) {
+    // Finds the minimal seam of an image no larger than the carver's image,
+    // with the same stride, using the carver's working buffers. Returns the
+    // total energy of the seam. The carver must not be incremental, and
+    // must not use the forward energy. If the energy uses the brightness,
+    // `luma` has room for the brightness of the image, which is computed
+    // first.
+    unsigned int energy;
+    unsigned long long start;
+    if (luma) {
+        start = trace_begin(carver->trace);
+        energy_luma_rows(img, 0, img->h, luma);
+        trace_end(
+                carver->trace,
+                TRACE_ENERGY,
+                -1,
+                start,
+                (long long) img->w * img->h,
+                0);
+    }
+
+    if (direction == VERTICAL_SEAMS) {
+        compute_vertical_seam_links_traced(carver, img, luma, -1);
+
+        start = trace_begin(carver->trace);
+        energy = get_minimal_seam(
+                &carver->vertical_seam_links,
+                img->w,
+                img->h,
+                seam);
+    } else {
+        compute_energy_traced(carver, img, luma, -1);
+        compute_horizontal_seam_links_traced(carver, img, -1);
+
+        start = trace_begin(carver->trace);
+        energy = get_minimal_seam(
+                &carver->horizontal_seam_links,
+                img->h,
+                img->w,
+                seam);
+    }
+
+    trace_end(
+            carver->trace,
+            TRACE_SEAMS,
+            -1,
+            start,
+            img->w + img->h,
+            0);
+
+    return energy;
+}
+
+static void copy_image(struct image_view *dst, const struct image_view *src) {
+    // Both images must have the same stride.
+    for (int y = 0; y < src->h; y++) {
+        memcpy(image_pixel(dst, 0, y), image_pixel(src, 0, y), src->w * 3);
+    }
+
+    dst->w = src->w;
+    dst->h = src->h;
+}
+
+static void copy_image_without_seam(
+        struct image_view *dst,
+        const struct image_view *src,
+        enum seam_direction direction,
+        const int *seam) {
+    // The same as copying the image and removing the seam from the copy, in
+    // a single pass. Both images must have the same stride.
+    if (direction == VERTICAL_SEAMS) {
+        for (int y = 0; y < src->h; y++) {
+            int seam_x = seam[src->h - 1 - y];
+            memcpy(image_pixel(dst, 0, y), image_pixel(src, 0, y), seam_x * 3);
+            memcpy(
+                    image_pixel(dst, seam_x, y),
+                    image_pixel(src, seam_x + 1, y),
+                    (src->w - seam_x - 1) * 3);
+        }
+
+        dst->w = src->w - 1;
+        dst->h = src->h;
+        return;
+    }
+
+    // Each row takes the runs of columns above the seam from the same row,
+    // and the runs at or below the seam from the row below.
+    for (int y = 0; y < src->h - 1; y++)
+    for (int x = 0; x < src->w;) {
+        int below = seam[src->w - 1 - x] <= y;
+        int run_end = x + 1;
+        while (run_end < src->w &&
+                (seam[src->w - 1 - run_end] <= y) == below) {
+            run_end++;
+        }
+
+        memcpy(
+                image_pixel(dst, x, y),
+                image_pixel(src, x, y + below),
+                (run_end - x) * 3);
+        x = run_end;
+    }
+
+    dst->w = src->w;
+    dst->h = src->h - 1;
+}
+
+int carver_find_greedy_seam_order(
+        struct carver *carver,
+        int num_vertical_seams,
+        int num_horizontal_seams,
+        enum seam_direction *order,
+        unsigned long long *total_energy) {
+    // On each step, removes whichever of the minimal vertical and horizontal
+    // seams has the lower energy, until either kind runs out. The seams are
+    // found in the carver's own buffers.
+    if (carver->energy_function == CARVER_FORWARD_ENERGY) {
+        fprintf(stderr, "Seam orders need an energy per pixel\n");
+        return 1;
+    }
+
+    if (check_not_incremental(carver)) { return 1; }
+
+    if (check_seam_counts(
+                carver,
+                num_vertical_seams,
+                num_horizontal_seams)) {
+        return 1;
+    }
+
+    int result = 0;
+    unsigned long long start = trace_begin(carver->trace);
+
+    const struct image_view *original = &carver->img;
+    struct image_view img = *original;
+    int *vertical_seam = carver->vertical_seams;
+    unsigned char *luma = NULL;
+
+    size_t img_size = (size_t) original->stride * original->h * 3;
+    size_t luma_size = carver->luma ? img_size / 3 : 0;
+    img.data = malloc(img_size);
+    luma = luma_size ? malloc(luma_size) : NULL;
+    if (!img.data || (luma_size && !luma)) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        result = 1;
+        goto cleanup;
+    }
+
+    copy_image(&img, original);
+    *total_energy = 0;
+
+    for (int vertical = 0, horizontal = 0;
+            vertical < num_vertical_seams ||
+            horizontal < num_horizontal_seams;) {
+        unsigned int vertical_energy = UINT_MAX;
+        unsigned int horizontal_energy = UINT_MAX;
+
+        if (vertical < num_vertical_seams) {
+            vertical_energy = find_minimal_seam(
+                    carver,
+                    &img,
+                    luma,
+                    VERTICAL_SEAMS,
+                    vertical_seam);
+        }
+
+        if (horizontal < num_horizontal_seams) {
+            horizontal_energy = find_minimal_seam(
+                    carver,
+                    &img,
+                    luma,
+                    HORIZONTAL_SEAMS,
+                    carver->horizontal_seam);
+        }
+
+        // Ties go to the vertical seam, which matches the sequential order.
+        if (vertical < num_vertical_seams &&
+                (horizontal == num_horizontal_seams ||
+                 vertical_energy <= horizontal_energy)) {
+            remove_vertical_seams(&img, vertical_seam, 1);
+            *total_energy += vertical_energy;
+            order[vertical++ + horizontal] = VERTICAL_SEAMS;
+        } else {
+            remove_horizontal_seam(&img, carver->horizontal_seam);
+            *total_energy += horizontal_energy;
+            order[vertical + horizontal++] = HORIZONTAL_SEAMS;
+        }
+    }
+
+cleanup:
+    if (img.data) { free(img.data); }
+    if (luma) { free(luma); }
+
+    trace_end(
+            carver->trace,
+            TRACE_ORDER,
+            -1,
+            start,
+            (long long) original->w * original->h,
+            img_size + luma_size);
+
+    return result;
+}
+
+int carver_find_optimal_seam_order(
+        struct carver *carver,
+        int num_vertical_seams,
+        int num_horizontal_seams,
+        enum seam_direction *order,
+        unsigned long long *total_energy) {
+    // The transport map from the seam carving paper: the minimal cost T(r, c)
+    // of removing r horizontal and c vertical seams is
+    //
+    //   min(T(r - 1, c) + E(minimal horizontal seam of I(r - 1, c)),
+    //       T(r, c - 1) + E(minimal vertical seam of I(r, c - 1)))
+    //
+    // where I(r, c) is the image reached by the better of the two. Only the
+    // costs and the choice made for each cell are stored for the whole map.
+    //
+    // Each image depends on a path through every earlier row and column of
+    // the map, so rebuilding one from a few checkpoints would mean replaying
+    // up to r + c seams per cell. Instead, the map is swept along its longer
+    // side, keeping one image per cell of its shorter side, updated in place:
+    // sweeping rows, slot c still holds I(r - 1, c) until it is replaced by
+    // I(r, c), and slot c - 1 already holds I(r, c - 1). Sweeping columns,
+    // the same goes with the roles of r and c swapped. Those images must fit
+    // in ORDER_MAX_SLOTS_BYTES. Returns non-zero on error.
+    if (carver->energy_function == CARVER_FORWARD_ENERGY) {
+        fprintf(stderr, "Seam orders need an energy per pixel\n");
+        return 1;
+    }
+
+    if (check_not_incremental(carver)) { return 1; }
+
+    if (check_seam_counts(
+                carver,
+                num_vertical_seams,
+                num_horizontal_seams)) {
+        return 1;
+    }
+
+    int result = 0;
+    unsigned long long start = trace_begin(carver->trace);
+
+    int num_columns = num_vertical_seams + 1;
+    int num_rows = num_horizontal_seams + 1;
+    const struct image_view *original = &carver->img;
+
+    // With fewer rows than columns, the slots are indexed by row, and each
+    // step along a slot removes a vertical seam.
+    int sweep_columns = num_rows < num_columns;
+    int num_slots = sweep_columns ? num_rows : num_columns;
+    int num_steps = sweep_columns ? num_columns : num_rows;
+    enum seam_direction slot_direction =
+        sweep_columns ? HORIZONTAL_SEAMS : VERTICAL_SEAMS;
+    enum seam_direction step_direction =
+        sweep_columns ? VERTICAL_SEAMS : HORIZONTAL_SEAMS;
+
+    // The copies of the image all share a single block.
+    size_t slot_size = (size_t) original->stride * original->h * 3;
+
+    // The seams found in the previous slot, and along the current one.
+    int *slot_seam = slot_direction == VERTICAL_SEAMS ?
+        carver->vertical_seams :
+        carver->horizontal_seam;
+    int *step_seam = step_direction == VERTICAL_SEAMS ?
+        carver->vertical_seams :
+        carver->horizontal_seam;
+
+    struct image_view *slots = NULL;
+    unsigned char *slots_data = NULL;
+    unsigned long long *costs = NULL;
+    unsigned char *choices = NULL;
+    unsigned char *luma = NULL;
+
+    // The brightness is recomputed for each image the seams are found in, so
+    // a single plane is shared by every slot.
+    size_t slots_size = num_slots * sizeof(struct image_view);
+    size_t slots_data_size = num_slots * slot_size;
+    size_t costs_size = num_rows * num_columns * sizeof(unsigned long long);
+    size_t choices_size = num_rows * num_columns;
+    size_t luma_size = carver->luma ? slot_size / 3 : 0;
+
+    if (slots_data_size > ORDER_MAX_SLOTS_BYTES) {
+        fprintf(
+                stderr,
+                "The optimal order of %d vertical and %d horizontal seams "
+                "needs %zu MB of images, more than the %llu MB allowed, use "
+                "the greedy order instead\n",
+                num_vertical_seams,
+                num_horizontal_seams,
+                slots_data_size >> 20,
+                ORDER_MAX_SLOTS_BYTES >> 20);
+
+        result = 1;
+        goto cleanup;
+    }
+
+    slots = malloc(slots_size);
+    slots_data = malloc(slots_data_size);
+    costs = malloc(costs_size);
+    choices = malloc(choices_size);
+    luma = luma_size ? malloc(luma_size) : NULL;
+    if (!slots || !slots_data || !costs || !choices ||
+            (luma_size && !luma)) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        result = 1;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < num_slots; i++) {
+        slots[i] = *original;
+        slots[i].data = slots_data + i * slot_size;
+    }
+
+    copy_image(&slots[0], original);
+    costs[0] = 0;
+
+    for (int step = 0; step < num_steps; step++)
+    for (int i = 0; i < num_slots; i++) {
+        if (step == 0 && i == 0) { continue; }
+
+        int r = sweep_columns ? i : step;
+        int c = sweep_columns ? step : i;
+        int cell = r * num_columns + c;
+
+        // Slot i holds the image one step back, and slot i - 1 holds the
+        // image one slot back, which is already at this step.
+        unsigned long long from_step = ULLONG_MAX;
+        unsigned long long from_slot = ULLONG_MAX;
+
+        if (step > 0) {
+            int previous = sweep_columns ? cell - 1 : cell - num_columns;
+            from_step = costs[previous] + find_minimal_seam(
+                    carver,
+                    &slots[i],
+                    luma,
+                    step_direction,
+                    step_seam);
+        }
+
+        if (i > 0) {
+            int previous = sweep_columns ? cell - num_columns : cell - 1;
+            from_slot = costs[previous] + find_minimal_seam(
+                    carver,
+                    &slots[i - 1],
+                    luma,
+                    slot_direction,
+                    slot_seam);
+        }
+
+        // Ties go to the vertical seam, which matches the sequential order.
+        int slot_wins = slot_direction == VERTICAL_SEAMS ?
+            from_slot <= from_step :
+            from_slot < from_step;
+        if (slot_wins) {
+            copy_image_without_seam(
+                    &slots[i],
+                    &slots[i - 1],
+                    slot_direction,
+                    slot_seam);
+            costs[cell] = from_slot;
+            choices[cell] = slot_direction;
+        } else if (step_direction == VERTICAL_SEAMS) {
+            remove_vertical_seams(&slots[i], step_seam, 1);
+            costs[cell] = from_step;
+            choices[cell] = step_direction;
+        } else {
+            remove_horizontal_seam(&slots[i], step_seam);
+            costs[cell] = from_step;
+            choices[cell] = step_direction;
+        }
+    }
+
+    *total_energy = costs[num_rows * num_columns - 1];
+
+    // Following the choices back from the last cell gives the order in
+    // reverse.
+    for (int r = num_rows - 1, c = num_columns - 1; r > 0 || c > 0;) {
+        enum seam_direction direction = choices[r * num_columns + c];
+        order[r + c - 1] = direction;
+
+        if (direction == VERTICAL_SEAMS) {
+            c--;
+        } else {
+            r--;
+        }
+    }
+
+cleanup:
+    if (slots) { free(slots); }
+    if (slots_data) { free(slots_data); }
+    if (costs) { free(costs); }
+    if (choices) { free(choices); }
+    if (luma) { free(luma); }
+
+    trace_end(
+            carver->trace,
+            TRACE_ORDER,
+            -1,
+            start,
+            (long long) original->w * original->h,
+            slots_size + slots_data_size + costs_size + choices_size +
+            luma_size);
+
+    return result;
+}
+
+// ITERATIONS /////////////////////////////////////////////////////////////////
+
+static int report_iteration(
+        struct carver *carver,
+        int iteration,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams) {
+    if (!carver->callback) { return 0; }
+
+    struct carver_iteration report = {
+        .iteration = iteration,
+        .img = &carver->img,
+        .direction = direction,
+        .seams = seams,
+        .num_seams = num_seams
+    };
+
+    unsigned long long start = trace_begin(carver->trace);
+    int result = carver->callback(carver->callback_context, &report);
+    trace_end(carver->trace, TRACE_CALLBACK, iteration, start, 0, 0);
+
+    return result;
+}
+
+static int run_iteration(
+        struct carver *carver,
+        int iteration,
+        int max_seams) {
+    // Removes up to `max_seams` seams, and returns the number of seams
+    // removed, or -1 on error.
+
+    struct image_view *img = &carver->img;
+    int w = img->w;
+    int h = img->h;
+
+    int use_pyramid = prepare_pyramid_traced(carver, iteration);
+
+    if (!carver->incremental && !use_pyramid) {
+        compute_vertical_seam_links_traced(
+                carver,
+                img,
+                carver->luma,
+                iteration);
+    }
+
+    int num_seams = 1;
+    max_seams =
+        max_seams < carver->seams_per_pass ? max_seams : carver->seams_per_pass;
+
+    unsigned long long start = trace_begin(carver->trace);
+    long long seams_work = w + (long long) h;
+    if (use_pyramid) {
+        carver->total_seam_energy += find_pyramid_seam(
+                &carver->pyramid,
+                img,
+                carver->luma,
+                carver->energy_function,
+                carver->vertical_seam_links.scratch_energy,
+                carver->vertical_seams);
+        seams_work = (long long) h *
+            corridor_columns(&carver->pyramid) *
+            carver->pyramid.active_levels;
+    } else if (max_seams > 1) {
+        unsigned long long seams_energy;
+        num_seams = get_low_energy_vertical_seams(
+                &carver->vertical_seam_links,
+                w,
+                h,
+                max_seams,
+                carver->seam_ends,
+                carver->claimed,
+                carver->vertical_seams,
+                &seams_energy);
+        carver->total_seam_energy += seams_energy;
+        seams_work = w + (long long) num_seams * h;
+    } else {
+        carver->total_seam_energy += get_minimal_seam(
+                &carver->vertical_seam_links,
+                w,
+                h,
+                carver->vertical_seams);
+    }
+    trace_end(
+            carver->trace,
+            TRACE_SEAMS,
+            iteration,
+            start,
+            seams_work,
+            0);
+
+    if (report_iteration(
+                carver,
+                iteration,
+                VERTICAL_SEAMS,
+                carver->vertical_seams,
+                num_seams)) {
+        return -1;
+    }
+
+    start = trace_begin(carver->trace);
+    record_removed_vertical_seams(carver, carver->vertical_seams, num_seams);
+    if (carver->luma) {
+        remove_vertical_seams_from_rows(
+                carver->luma,
+                1,
+                img->stride,
+                w,
+                h,
+                carver->vertical_seams,
+                num_seams);
+    }
+    remove_vertical_seams(img, carver->vertical_seams, num_seams);
+    trace_end(
+            carver->trace,
+            TRACE_REMOVAL,
+            iteration,
+            start,
+            (long long) w * h,
+            0);
+
+    if (use_pyramid) {
+        start = trace_begin(carver->trace);
+        pyramid_after_vertical_seam_removal(&carver->pyramid);
+        trace_end(
+                carver->trace,
+                TRACE_PYRAMID,
+                iteration,
+                start,
+                (long long) h * carver->pyramid.active_levels,
+                0);
+    }
+
+    if (num_seams > 1) { return num_seams; }
+
+    if (carver->incremental) {
+        // Only the pixels bordering the seam have their energy recomputed,
+        // and only the links in the seam's cone of influence.
+        start = trace_begin(carver->trace);
+        energy_after_vertical_seam_removal(
+                carver->energy_function,
+                carver->energy,
+                img,
+                carver->luma,
+                carver->vertical_seams);
+        trace_end(
+                carver->trace,
+                TRACE_ENERGY,
+                iteration,
+                start,
+                2 * h,
+                0);
+
+        start = trace_begin(carver->trace);
+        long long num_recomputed =
+            vertical_seam_links_after_vertical_seam_removal(
+                    &carver->vertical_seam_links,
+                    carver->energy,
+                    carver->vertical_seams,
+                    w,
+                    h);
+        trace_end(
+                carver->trace,
+                TRACE_SEAM_LINKS,
+                iteration,
+                start,
+                num_recomputed,
+                0);
+    }
+
+    return 1;
+}
+
+static int run_horizontal_iteration(struct carver *carver, int iteration) {
+    // Removes one horizontal seam. Returns non-zero on error.
+    if (carver->energy_function == CARVER_FORWARD_ENERGY) {
+        fprintf(stderr, "Horizontal seams need an energy per pixel\n");
+        return 1;
+    }
+
+    struct image_view *img = &carver->img;
+    int w = img->w;
+    int h = img->h;
+
+    compute_energy_traced(carver, img, carver->luma, iteration);
+    compute_horizontal_seam_links_traced(carver, img, iteration);
+
+    unsigned long long start = trace_begin(carver->trace);
+    carver->total_seam_energy += get_minimal_seam(
+            &carver->horizontal_seam_links,
+            h,
+            w,
+            carver->horizontal_seam);
+    trace_end(carver->trace, TRACE_SEAMS, iteration, start, w + h, 0);
+
+    if (report_iteration(
+                carver,
+                iteration,
+                HORIZONTAL_SEAMS,
+                carver->horizontal_seam,
+                1)) {
+        return 1;
+    }
+
+    start = trace_begin(carver->trace);
+    if (carver->luma) {
+        remove_horizontal_seam_from_rows(
+                carver->luma,
+                1,
+                img->stride,
+                w,
+                h,
+                carver->horizontal_seam);
+    }
+    remove_horizontal_seam(img, carver->horizontal_seam);
+    trace_end(
+            carver->trace,
+            TRACE_REMOVAL,
+            iteration,
+            start,
+            (long long) w * h,
+            0);
+
+    carver->num_seams_removed++;
+
+    // The pyramid levels are only kept up to date for vertical seams.
+    carver->pyramid.active_levels = -1;
+
+    return 0;
+}
+
+void carver_set_iteration_callback(
+        struct carver *carver,
+        carver_iteration_callback callback,
+        void *context) {
+    carver->callback = callback;
+    carver->callback_context = context;
+}
+
+int carver_remove_vertical_seams(struct carver *carver, int num_seams) {
+    if (check_seam_counts(carver, num_seams, 0)) { return 1; }
+
+    for (int removed = 0; removed < num_seams; carver->num_iterations++) {
+        int removed_this_iteration = run_iteration(
+                carver,
+                carver->num_iterations,
+                num_seams - removed);
+
+        if (removed_this_iteration < 0) {
+            fprintf(
+                    stderr,
+                    "Error running iteration %d\n",
+                    carver->num_iterations);
+            return 1;
+        }
+
+        removed += removed_this_iteration;
+    }
+
+    return 0;
+}
+
+int carver_remove_horizontal_seams(struct carver *carver, int num_seams) {
+    if (check_seam_counts(carver, 0, num_seams) ||
+            check_horizontal_seams_untracked(carver, num_seams)) {
+        return 1;
+    }
+    if (num_seams == 0) { return 0; }
+
+    for (int removed = 0; removed < num_seams; removed++) {
+        if (run_horizontal_iteration(carver, carver->num_iterations++)) {
+            fprintf(
+                    stderr,
+                    "Error running iteration %d\n",
+                    carver->num_iterations - 1);
+            return 1;
+        }
+    }
+
+    // The energy and the vertical seam links are only kept up to date for
+    // vertical seams, so they are recomputed once for the shorter image.
+    if (carver->incremental) {
+        compute_energy_traced(carver, &carver->img, carver->luma, -1);
+        compute_vertical_seam_links_traced(
+                carver,
+                &carver->img,
+                carver->luma,
+                -1);
+    }
+
+    return 0;
+}
+
+int carver_remove_seams_in_order(
+        struct carver *carver,
+        const enum seam_direction *order,
+        int num_seams) {
+    if (check_not_incremental(carver)) { return 1; }
+
+    int num_vertical_seams = 0;
+    for (int i = 0; i < num_seams; i++) {
+        num_vertical_seams += order[i] == VERTICAL_SEAMS;
+    }
+
+    if (check_seam_counts(
+                carver,
+                num_vertical_seams,
+                num_seams - num_vertical_seams) ||
+            check_horizontal_seams_untracked(
+                carver,
+                num_seams - num_vertical_seams)) {
+        return 1;
+    }
+
+    for (int i = 0; i < num_seams; i++, carver->num_iterations++) {
+        int failed = order[i] == VERTICAL_SEAMS ?
+            run_iteration(carver, carver->num_iterations, 1) < 0 :
+            run_horizontal_iteration(carver, carver->num_iterations);
+
+        if (failed) {
+            fprintf(
+                    stderr,
+                    "Error running iteration %d\n",
+                    carver->num_iterations);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+const struct image_view * carver_image(const struct carver *carver) {
+    return &carver->img;
+}
+
+const unsigned int * carver_compute_energy(struct carver *carver) {
+    if (carver->energy_function == CARVER_FORWARD_ENERGY) { return NULL; }
+
+    // Incremental carvers already keep the energy up to date.
+    if (carver->incremental) { return carver->energy; }
+
+    compute_energy_traced(
+            carver,
+            &carver->img,
+            carver->luma,
+            carver->num_iterations);
+    return carver->energy;
+}
+
+void carver_compact_image(struct carver *carver) {
+    struct image_view *img = &carver->img;
+    if (carver->luma) {
+        compact_rows(carver->luma, 1, img->stride, img->w, img->h);
+    }
+    if (carver->incremental) {
+        compact_rows(
+                (unsigned char *) carver->energy,
+                sizeof(unsigned int),
+                img->stride,
+                img->w,
+                img->h);
+    }
+    compact_image(img);
+}
+
+unsigned long long carver_total_seam_energy(const struct carver *carver) {
+    return carver->total_seam_energy;
+}
+
+int carver_num_seams_removed(const struct carver *carver) {
+    return carver->num_seams_removed;
+}
+
+const unsigned int * carver_removal_order(const struct carver *carver) {
+    return carver->removal_order;
+}
@@ -0,0 +1,231 @@
+#ifndef CARVER_H
+#define CARVER_H
+
+#include "seams.h"
+
+// The seam carving engine, built as libseamcarver. A carver removes seams in
+// place from an RGB image owned by the caller, one or more seams per
+// iteration, and reports each iteration's seams through an optional
+// callback.
+//
+// All the working buffers of a carver are laid out in a single arena, sized
+// up front from the dimensions of the image, so carving performs a constant
+// number of allocations no matter how many seams are removed.
+
+struct thread_pool;
+struct trace;
+struct carver;
+
+struct image_view {
+    // RGB pixel data, 3 bytes per pixel.
+    unsigned char *data;
+
+    int w;
+    int h;
+
+    // The number of pixels from the start of one row to the start of the next
+    // row. Seams are removed in place, so the stride stays at the original
+    // width of the image even as the width shrinks.
+    int stride;
+};
+
+// How the cost of removing each pixel is measured. Every energy except the
+// forward energy is computed for each pixel from its neighborhood, and can
+// be used for any kind of seam.
+enum carver_energy {
+    // The squared differences of each color channel between the left and
+    // right neighbors, and between the top and bottom neighbors of each
+    // pixel, also known as the dual gradient.
+    CARVER_GRADIENT_ENERGY,
+
+    // The absolute differences instead of the squared differences.
+    CARVER_L1_GRADIENT_ENERGY,
+
+    // The dual gradient of the brightness, ignoring the colors.
+    CARVER_LUMA_GRADIENT_ENERGY,
+
+    // The Sobel and Scharr operators on each color channel, which smooth
+    // out noise using the diagonal neighbors.
+    CARVER_SOBEL_ENERGY,
+    CARVER_SCHARR_ENERGY,
+
+    // The dual gradient plus the entropy of the brightness in a 9x9 window,
+    // keeping the seams out of textured areas.
+    CARVER_ENTROPY_ENERGY,
+
+    // The dual gradient divided by the largest bin of a histogram of the
+    // gradient orientations in an 11x11 window, favoring lone edges over
+    // strongly oriented textures.
+    CARVER_HOG_ENERGY,
+
+    // The forward energy: the gradient of the edges created by bringing the
+    // neighbors of the removed pixels together, computed while finding the
+    // seams, with no separate energy pass. Only for vertical seams, and
+    // never incremental.
+    CARVER_FORWARD_ENERGY,
+
+    NUM_CARVER_ENERGIES
+};
+
+// The short name of each energy, as accepted by `carver_parse_energy`.
+const char * carver_energy_name(enum carver_energy energy);
+
+// Parses an energy name as returned by `carver_energy_name`. Returns
+// non-zero if the name is not recognized.
+int carver_parse_energy(const char *name, enum carver_energy *energy);
+
+// Whether the energy of each pixel only depends on its left, right, top and
+// bottom neighbors, so removing a vertical seam only changes the energy of
+// the pixels bordering it. Incremental carvers need such an energy.
+int carver_energy_is_incremental(enum carver_energy energy);
+
+// Computes the energy of every pixel of `img` into `energy_out`, using the
+// same stride, one pixel at a time, straight from the definition of the
+// energy. The carver uses faster loops computing the same values, which this
+// serves as a reference for. Returns non-zero with the forward energy.
+int carver_reference_energy(
+        const struct image_view *img,
+        enum carver_energy energy,
+        unsigned int *energy_out);
+
+// The state of the image at the start of an iteration, along with the seams
+// about to be removed from it.
+struct carver_iteration {
+    int iteration;
+    const struct image_view *img;
+
+    enum seam_direction direction;
+    const int *seams;
+    int num_seams;
+};
+
+// Returns non-zero to stop the carving with an error.
+typedef int (*carver_iteration_callback)(
+        void *context,
+        const struct carver_iteration *iteration);
+
+// Creates a carver removing seams from the `w` by `h` image in `data`, which
+// must outlive the carver.
+//
+// - `energy` measures the cost of removing each pixel.
+// - With `incremental`, the energy and the vertical seam links are kept up
+//   to date as seams are removed, instead of being recomputed on every
+//   iteration. The output is identical either way. Only for the gradient,
+//   L1 gradient and luma gradient energies.
+// - Up to `seams_per_pass` non-crossing vertical seams are removed on each
+//   iteration, trading quality for speed. Must be at least 1, and can't be
+//   above 1 with `incremental`.
+// - With `pyramid_levels` above 0, up to that many levels of downsampled
+//   images are kept. Each vertical seam is found on the coarsest level, then
+//   refined on each finer level within `corridor_radius` pixels of the seam
+//   found on the level above, trading quality for speed on large images.
+//   Can't be combined with `incremental`, `seams_per_pass` above 1 or the
+//   forward energy.
+// - With `track_removal_order`, the seam that removed each pixel of the
+//   original image is recorded, see `carver_removal_order`. Only vertical
+//   seams can be removed then.
+// - The energy and the seams are computed on `pool`, which may be NULL.
+// - Every stage of every iteration is timed in `trace`, which may be NULL.
+//
+// The cumulative energies of the seams are unsigned ints, so images taller
+// than the energy supports are rejected: about 11,000 pixels for most
+// energies, 10,000 for the entropy. Horizontal seams are bound by the width
+// the same way. Returns NULL on error.
+struct carver * carver_create(
+        unsigned char *data,
+        int w,
+        int h,
+        enum carver_energy energy,
+        int incremental,
+        int seams_per_pass,
+        int pyramid_levels,
+        int corridor_radius,
+        int track_removal_order,
+        struct thread_pool *pool,
+        struct trace *trace);
+
+void carver_free(struct carver *carver);
+
+// Calls `callback` at every following iteration, right before its seams are
+// removed.
+void carver_set_iteration_callback(
+        struct carver *carver,
+        carver_iteration_callback callback,
+        void *context);
+
+// Removes `num_seams` vertical seams, in as many iterations as needed given
+// the number of seams per pass. Returns non-zero on error, including when the
+// image isn't wider than `num_seams`.
+int carver_remove_vertical_seams(struct carver *carver, int num_seams);
+
+// Removes `num_seams` horizontal seams, one per iteration, always found from
+// scratch. Returns non-zero on error, including when the image isn't taller
+// than `num_seams` and when the removal order is tracked.
+int carver_remove_horizontal_seams(struct carver *carver, int num_seams);
+
+// Finds an order in which to remove the given numbers of vertical and
+// horizontal seams, writing one direction per seam to `order`, along with
+// the total energy of the seams removed in that order. The greedy order
+// picks the lower energy seam on each step, while the optimal order is
+// found by dynamic programming over every order.
+//
+// Only the costs and choices of the optimal order are kept for every
+// combination of seams. Rather than rebuilding the intermediate images on
+// demand from those choices, which would mean finding up to every earlier
+// seam again for each combination, one copy of the image is kept per
+// vertical or per horizontal seam, whichever is fewer. Those copies are
+// limited to 1 GB, and the optimal order fails beyond that: a 4 megapixel
+// image only fits about 85 seams in the shorter direction, and larger
+// requests should use the greedy order.
+//
+// Neither changes the image. The carver must not be incremental. Returns
+// non-zero on error.
+int carver_find_greedy_seam_order(
+        struct carver *carver,
+        int num_vertical_seams,
+        int num_horizontal_seams,
+        enum seam_direction *order,
+        unsigned long long *total_energy);
+
+int carver_find_optimal_seam_order(
+        struct carver *carver,
+        int num_vertical_seams,
+        int num_horizontal_seams,
+        enum seam_direction *order,
+        unsigned long long *total_energy);
+
+// Removes one seam per iteration, in the given order. The carver must not be
+// incremental, and must not track the removal order if there are horizontal
+// seams. Returns non-zero on error.
+int carver_remove_seams_in_order(
+        struct carver *carver,
+        const enum seam_direction *order,
+        int num_seams);
+
+// The image in its current state. Its stride stays the original width until
+// the image is compacted.
+const struct image_view * carver_image(const struct carver *carver);
+
+// Computes the energy of the image in its current state, using the
+// same stride, for visualizations. Finding vertical seams never needs the
+// energy of the whole image, only of one row at a time, so it is only
+// computed on request, except by incremental carvers, which return the
+// energy they keep up to date. The energy stays valid until the next seam is
+// removed. Returns NULL with forward energy.
+const unsigned int * carver_compute_energy(struct carver *carver);
+
+// Moves the rows of the image next to each other, so the stride matches the
+// width. No more seams can be removed afterwards.
+void carver_compact_image(struct carver *carver);
+
+// The sum of the energies of every seam removed so far.
+unsigned long long carver_total_seam_energy(const struct carver *carver);
+
+// The number of vertical and horizontal seams removed so far.
+int carver_num_seams_removed(const struct carver *carver);
+
+// Only available with `track_removal_order`. For each pixel of the original
+// image, the index of the vertical seam that removed it, or UINT_MAX.
+const unsigned int * carver_removal_order(const struct carver *carver);
+
+#endif
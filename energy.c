@@ -0,0 +1,715 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "energy.h"
+#include "simd.h"
+
+// Every energy function is evaluated on the clamped neighborhood of each
+// pixel: the rows above the top of the image repeat the first row, and so on
+// for every border. Each kernel receives the rows above and below the pixel,
+// and the byte offsets of the pixel and of its left and right neighbors.
+//
+// The energies are scaled so that a pixel's energy never exceeds the
+// largest gradient energy by much. The cumulative energy of a seam still
+// only fits an unsigned int for seams of up to about 10,000 pixels, so
+// `energy_max_seam_length` gives the exact bound for each energy.
+
+// The squared differences of the 3 channels in both directions, which the
+// Sobel, Scharr and forward energies also stay within.
+#define MAX_GRADIENT_ENERGY (3 * 2 * 255 * 255)
+
+static const char *energy_names[NUM_CARVER_ENERGIES] = {
+    [CARVER_GRADIENT_ENERGY] = "gradient",
+    [CARVER_L1_GRADIENT_ENERGY] = "l1",
+    [CARVER_LUMA_GRADIENT_ENERGY] = "luma",
+    [CARVER_SOBEL_ENERGY] = "sobel",
+    [CARVER_SCHARR_ENERGY] = "scharr",
+    [CARVER_ENTROPY_ENERGY] = "entropy",
+    [CARVER_HOG_ENERGY] = "hog",
+    [CARVER_FORWARD_ENERGY] = "forward"
+};
+
+const char * carver_energy_name(enum carver_energy energy) {
+    return energy_names[energy];
+}
+
+int carver_parse_energy(const char *name, enum carver_energy *energy) {
+    for (int i = 0; i < NUM_CARVER_ENERGIES; i++) {
+        if (strcmp(name, energy_names[i]) == 0) {
+            *energy = i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int carver_energy_is_incremental(enum carver_energy energy) {
+    return energy == CARVER_GRADIENT_ENERGY ||
+        energy == CARVER_L1_GRADIENT_ENERGY ||
+        energy == CARVER_LUMA_GRADIENT_ENERGY;
+}
+
+static const unsigned char * image_row(const struct image_view *img, int y) {
+    y = y < 0 ? 0 : y >= img->h ? img->h - 1 : y;
+    return img->data + (size_t) y * img->stride * 3;
+}
+
+static inline int clamp_column(const struct image_view *img, int x) {
+    return x < 0 ? 0 : x >= img->w ? img->w - 1 : x;
+}
+
+static inline int luma(const unsigned char *p) {
+    // The Rec. 601 weights, in 8-bit fixed point.
+    return (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+}
+
+// BRIGHTNESS PLANE ///////////////////////////////////////////////////////////
+
+// The energies of the brightness read it from a plane with one byte per
+// pixel, kept alongside the image, rather than converting the colors of every
+// pixel they look at, often several times over. Reading one byte per pixel
+// instead of three also cuts the memory traffic of the energy by about 3x.
+
+int energy_uses_luma(enum carver_energy energy) {
+    return energy == CARVER_LUMA_GRADIENT_ENERGY ||
+        energy == CARVER_ENTROPY_ENERGY ||
+        energy == CARVER_HOG_ENERGY;
+}
+
+void energy_luma_rows(
+        const struct image_view *img,
+        int y0,
+        int y1,
+        unsigned char *luma_plane) {
+    for (int y = y0; y < y1; y++) {
+        const unsigned char *row = img->data + (size_t) y * img->stride * 3;
+        unsigned char *luma_row = luma_plane + (size_t) y * img->stride;
+
+        for (int x = 0; x < img->w; x++) {
+            luma_row[x] = luma(row + x * 3);
+        }
+    }
+}
+
+static const unsigned char * luma_row(
+        const struct image_view *img,
+        const unsigned char *luma_plane,
+        int y) {
+    y = y < 0 ? 0 : y >= img->h ? img->h - 1 : y;
+    return luma_plane + (size_t) y * img->stride;
+}
+
+// POINT KERNELS //////////////////////////////////////////////////////////////
+
+// The squared differences of each color channel, between the left and right
+// neighbors and between the top and bottom neighbors.
+static inline unsigned int gradient_energy(
+        const unsigned char *above,
+        const unsigned char *row,
+        const unsigned char *below,
+        int left,
+        int x,
+        int right) {
+    unsigned int energy = 0;
+    for (int c = 0; c < 3; c++) {
+        int dx = row[left + c] - row[right + c];
+        int dy = above[x + c] - below[x + c];
+        energy += dx * dx + dy * dy;
+    }
+
+    return energy;
+}
+
+// The same differences as the gradient energy, without squaring them. Much
+// cheaper, and less dominated by the strongest edges.
+static inline unsigned int l1_gradient_energy(
+        const unsigned char *above,
+        const unsigned char *row,
+        const unsigned char *below,
+        int left,
+        int x,
+        int right) {
+    unsigned int energy = 0;
+    for (int c = 0; c < 3; c++) {
+        energy += abs(row[left + c] - row[right + c]);
+        energy += abs(above[x + c] - below[x + c]);
+    }
+
+    return energy;
+}
+
+// The gradient of the brightness only, ignoring edges between colors of the
+// same brightness.
+static inline unsigned int luma_gradient_energy(
+        const unsigned char *above,
+        const unsigned char *row,
+        const unsigned char *below,
+        int left,
+        int x,
+        int right) {
+    int dx = luma(row + left) - luma(row + right);
+    int dy = luma(above + x) - luma(below + x);
+
+    return dx * dx + dy * dy;
+}
+
+// The Sobel and Scharr operators also weigh in the diagonal neighbors,
+// smoothing out noise. Their weights add up to 4 and 16 on each side, so the
+// squared gradients are divided by 16 and 256, putting a step between two
+// colors at the same energy as with the gradient energy.
+static inline unsigned int sobel_energy(
+        const unsigned char *above,
+        const unsigned char *row,
+        const unsigned char *below,
+        int left,
+        int x,
+        int right) {
+    unsigned int energy = 0;
+    for (int c = 0; c < 3; c++) {
+        int gx = (above[right + c] + 2 * row[right + c] + below[right + c]) -
+            (above[left + c] + 2 * row[left + c] + below[left + c]);
+        int gy = (below[left + c] + 2 * below[x + c] + below[right + c]) -
+            (above[left + c] + 2 * above[x + c] + above[right + c]);
+        energy += gx * gx + gy * gy;
+    }
+
+    return energy >> 4;
+}
+
+static inline unsigned int scharr_energy(
+        const unsigned char *above,
+        const unsigned char *row,
+        const unsigned char *below,
+        int left,
+        int x,
+        int right) {
+    unsigned int energy = 0;
+    for (int c = 0; c < 3; c++) {
+        int gx = 3 * (above[right + c] - above[left + c]) +
+            10 * (row[right + c] - row[left + c]) +
+            3 * (below[right + c] - below[left + c]);
+        int gy = 3 * (below[left + c] - above[left + c]) +
+            10 * (below[x + c] - above[x + c]) +
+            3 * (below[right + c] - above[right + c]);
+        energy += gx * gx + gy * gy;
+    }
+
+    return energy >> 8;
+}
+
+// Evaluates a point kernel at column x, given the rows around it.
+#define POINT_ENERGY(kernel, img, above, row, below, x) \
+    kernel( \
+            above, \
+            row, \
+            below, \
+            clamp_column(img, (x) - 1) * 3, \
+            (x) * 3, \
+            clamp_column(img, (x) + 1) * 3)
+
+// Defines `<kernel>_span`, which evaluates the kernel on every pixel of a
+// span, with the kernel inlined into the loop.
+#define DEFINE_POINT_ENERGY_SPAN(kernel) \
+    static void kernel##_span( \
+            const struct image_view *img, \
+            int y, \
+            int x0, \
+            int x1, \
+            unsigned int *energy_row) { \
+        const unsigned char *above = image_row(img, y - 1); \
+        const unsigned char *row = image_row(img, y); \
+        const unsigned char *below = image_row(img, y + 1); \
+        \
+        for (int x = x0; x < x1; x++) { \
+            energy_row[x] = \
+                POINT_ENERGY(kernel, img, above, row, below, x); \
+        } \
+    }
+
+DEFINE_POINT_ENERGY_SPAN(l1_gradient_energy)
+DEFINE_POINT_ENERGY_SPAN(sobel_energy)
+DEFINE_POINT_ENERGY_SPAN(scharr_energy)
+
+static void gradient_energy_span(
+        const struct image_view *img,
+        int y,
+        int x0,
+        int x1,
+        unsigned int *energy_row) {
+    int w = img->w;
+    const unsigned char *above = image_row(img, y - 1);
+    const unsigned char *row = image_row(img, y);
+    const unsigned char *below = image_row(img, y + 1);
+
+    int x = x0;
+    if (x == 0 && x < x1) {
+        energy_row[0] =
+            POINT_ENERGY(gradient_energy, img, above, row, below, 0);
+        x = 1;
+    }
+
+    // The vectorized kernel handles as much of the interior of the span as
+    // it can, leaving any leftover pixels. It sees the span as a row starting
+    // one column to the left, whose last column is the first one it must not
+    // compute, or the last column of the image.
+    int last = x1 < w - 1 ? x1 : w - 1;
+    if (x < last) {
+        x += simd_energy_row(
+                above + (x - 1) * 3,
+                row + (x - 1) * 3,
+                below + (x - 1) * 3,
+                last - x + 2,
+                energy_row + x - 1) - 1;
+    }
+
+    for (; x < x1; x++) {
+        energy_row[x] =
+            POINT_ENERGY(gradient_energy, img, above, row, below, x);
+    }
+}
+
+static inline unsigned int plane_gradient_energy(
+        const struct image_view *img,
+        const unsigned char *above,
+        const unsigned char *row,
+        const unsigned char *below,
+        int x) {
+    int dx = row[clamp_column(img, x - 1)] - row[clamp_column(img, x + 1)];
+    int dy = above[x] - below[x];
+
+    return dx * dx + dy * dy;
+}
+
+static void luma_gradient_energy_span(
+        const struct image_view *img,
+        const unsigned char *luma_plane,
+        int y,
+        int x0,
+        int x1,
+        unsigned int *energy_row) {
+    // The same loop as for the gradient energy, on the brightness plane.
+    int w = img->w;
+    const unsigned char *above = luma_row(img, luma_plane, y - 1);
+    const unsigned char *row = luma_row(img, luma_plane, y);
+    const unsigned char *below = luma_row(img, luma_plane, y + 1);
+
+    int x = x0;
+    if (x == 0 && x < x1) {
+        energy_row[0] = plane_gradient_energy(img, above, row, below, 0);
+        x = 1;
+    }
+
+    int last = x1 < w - 1 ? x1 : w - 1;
+    if (x < last) {
+        x += simd_luma_energy_row(
+                above + x - 1,
+                row + x - 1,
+                below + x - 1,
+                last - x + 2,
+                energy_row + x - 1) - 1;
+    }
+
+    for (; x < x1; x++) {
+        energy_row[x] = plane_gradient_energy(img, above, row, below, x);
+    }
+}
+
+// ENTROPY ////////////////////////////////////////////////////////////////////
+
+// The gradient energy, plus the entropy of the brightness in a 9x9 window
+// around the pixel, as suggested in the original paper. Textured areas have
+// a high entropy even where their gradient happens to be low, so seams go
+// around them. The brightness is quantized to 16 levels.
+//
+// With n pixels at each level, the entropy of the window is
+// log2(N) - sum(n log2 n) / N, for N pixels. `entropy_terms` holds
+// n log2 n in fixed point, with 6 fractional bits, so the energy added is
+// the entropy times 64 N, up to about 33,000.
+
+#define ENTROPY_RADIUS 4
+#define ENTROPY_WINDOW (2 * ENTROPY_RADIUS + 1)
+#define ENTROPY_PIXELS (ENTROPY_WINDOW * ENTROPY_WINDOW)
+#define ENTROPY_LEVELS 16
+
+static const unsigned short entropy_terms[ENTROPY_PIXELS + 1] = {
+    0, 0, 128, 304, 512, 743, 993, 1258, 1536, 1826, 2126, 2435, 2753, 3079,
+    3411, 3751, 4096, 4447, 4804, 5165, 5532, 5903, 6279, 6659, 7043, 7430,
+    7822, 8216, 8615, 9016, 9421, 9829, 10240, 10654, 11070, 11490, 11912,
+    12336, 12763, 13192, 13624, 14058, 14495, 14933, 15374, 15817, 16261,
+    16708, 17157, 17608, 18060, 18515, 18971, 19429, 19889, 20350, 20814,
+    21278, 21745, 22213, 22682, 23154, 23626, 24100, 24576, 25053, 25532,
+    26011, 26493, 26975, 27459, 27944, 28431, 28919, 29408, 29898, 30390,
+    30883, 31377, 31872, 32368, 32866
+};
+
+static inline unsigned int entropy_of(const int *histogram) {
+    int entropy = entropy_terms[ENTROPY_PIXELS];
+    for (int level = 0; level < ENTROPY_LEVELS; level++) {
+        entropy -= entropy_terms[histogram[level]];
+    }
+
+    // The rounding of the terms can't make up for the smallest possible
+    // entropy above zero, but stay on the safe side.
+    return entropy > 0 ? entropy : 0;
+}
+
+static inline void entropy_column(
+        const struct image_view *img,
+        const unsigned char **luma_rows,
+        int x,
+        int *column) {
+    memset(column, 0, ENTROPY_LEVELS * sizeof(int));
+
+    x = clamp_column(img, x);
+    for (int i = 0; i < ENTROPY_WINDOW; i++) {
+        column[luma_rows[i][x] >> 4]++;
+    }
+}
+
+static void entropy_energy_span(
+        const struct image_view *img,
+        const unsigned char *luma_plane,
+        int y,
+        int x0,
+        int x1,
+        unsigned int *energy_row) {
+    // The window slides along the row, so each pixel only adds the column
+    // entering the window and removes the one leaving it. The histogram of
+    // each column in the window is kept, so each column is only read once.
+    const unsigned char *luma_rows[ENTROPY_WINDOW];
+    for (int i = 0; i < ENTROPY_WINDOW; i++) {
+        luma_rows[i] = luma_row(img, luma_plane, y - ENTROPY_RADIUS + i);
+    }
+
+    const unsigned char *above = image_row(img, y - 1);
+    const unsigned char *row = image_row(img, y);
+    const unsigned char *below = image_row(img, y + 1);
+
+    // Column x - ENTROPY_RADIUS, about to leave the window, is in
+    // columns[oldest], and the slot before it is free.
+    int columns[ENTROPY_WINDOW][ENTROPY_LEVELS];
+    int histogram[ENTROPY_LEVELS] = { 0 };
+    for (int i = 0; i < ENTROPY_WINDOW - 1; i++) {
+        entropy_column(img, luma_rows, x0 - ENTROPY_RADIUS + i, columns[i]);
+        for (int level = 0; level < ENTROPY_LEVELS; level++) {
+            histogram[level] += columns[i][level];
+        }
+    }
+
+    int oldest = 0;
+    for (int x = x0; x < x1; x++) {
+        int *entering = columns[(oldest + ENTROPY_WINDOW - 1) % ENTROPY_WINDOW];
+        entropy_column(img, luma_rows, x + ENTROPY_RADIUS, entering);
+        for (int level = 0; level < ENTROPY_LEVELS; level++) {
+            histogram[level] += entering[level];
+        }
+
+        energy_row[x] =
+            POINT_ENERGY(gradient_energy, img, above, row, below, x) +
+            entropy_of(histogram);
+
+        for (int level = 0; level < ENTROPY_LEVELS; level++) {
+            histogram[level] -= columns[oldest][level];
+        }
+        oldest = oldest + 1 < ENTROPY_WINDOW ? oldest + 1 : 0;
+    }
+}
+
+static unsigned int entropy_energy_at(
+        const struct image_view *img,
+        int x,
+        int y) {
+    int histogram[ENTROPY_LEVELS] = { 0 };
+    for (int dy = -ENTROPY_RADIUS; dy <= ENTROPY_RADIUS; dy++)
+    for (int dx = -ENTROPY_RADIUS; dx <= ENTROPY_RADIUS; dx++) {
+        const unsigned char *p =
+            image_row(img, y + dy) + clamp_column(img, x + dx) * 3;
+        histogram[luma(p) >> 4]++;
+    }
+
+    return entropy_of(histogram);
+}
+
+// HISTOGRAMS OF ORIENTED GRADIENTS ///////////////////////////////////////////
+
+// The gradient energy, divided by the largest bin of a histogram of the
+// orientations of the brightness gradients in an 11x11 window, as suggested
+// in the original paper. Edges standing out of an otherwise flat area keep
+// their energy, while the edges of a strongly oriented texture lose some of
+// it, so seams can go through the texture instead of around a lone edge.
+//
+// The orientations are split into 8 octants, found by comparing the
+// components of the gradient instead of computing its angle, and each
+// pixel's gradient counts for the sum of the absolute values of its
+// components. Dividing by 1 + max / 256 instead of the maximum itself keeps
+// flat areas from blowing up the energy.
+
+#define HOG_RADIUS 5
+#define HOG_WINDOW (2 * HOG_RADIUS + 1)
+#define HOG_BINS 8
+
+static inline void add_gradient_orientation(
+        int gx,
+        int gy,
+        int *histogram) {
+    int ax = abs(gx);
+    int ay = abs(gy);
+    int octant = ax >= ay ? 0 : 1;
+    if (gx < 0) { octant = 3 - octant; }
+    if (gy < 0) { octant = 7 - octant; }
+
+    histogram[octant] += ax + ay;
+}
+
+static inline void add_oriented_gradient(
+        const struct image_view *img,
+        int x,
+        int y,
+        int *histogram) {
+    // (x, y) must be within the image.
+    const unsigned char *row = image_row(img, y);
+    int gx = luma(row + clamp_column(img, x + 1) * 3) -
+        luma(row + clamp_column(img, x - 1) * 3);
+    int gy = luma(image_row(img, y + 1) + x * 3) -
+        luma(image_row(img, y - 1) + x * 3);
+
+    add_gradient_orientation(gx, gy, histogram);
+}
+
+// The rows of the brightness plane around each row of the window, the window
+// rows themselves being clamped to the image first.
+struct hog_window_row {
+    const unsigned char *above;
+    const unsigned char *row;
+    const unsigned char *below;
+};
+
+static inline void oriented_gradient_column(
+        const struct image_view *img,
+        const struct hog_window_row *window,
+        int x,
+        int *column) {
+    memset(column, 0, HOG_BINS * sizeof(int));
+
+    x = clamp_column(img, x);
+    int left = clamp_column(img, x - 1);
+    int right = clamp_column(img, x + 1);
+    for (int i = 0; i < HOG_WINDOW; i++) {
+        add_gradient_orientation(
+                window[i].row[right] - window[i].row[left],
+                window[i].below[x] - window[i].above[x],
+                column);
+    }
+}
+
+static inline unsigned int hog_weighted(
+        unsigned int gradient,
+        const int *histogram) {
+    int max = 0;
+    for (int bin = 0; bin < HOG_BINS; bin++) {
+        max = histogram[bin] > max ? histogram[bin] : max;
+    }
+
+    return gradient * 256 / (256 + max);
+}
+
+static void hog_energy_span(
+        const struct image_view *img,
+        const unsigned char *luma_plane,
+        int y,
+        int x0,
+        int x1,
+        unsigned int *energy_row) {
+    // Like the entropy, the window slides along the row, keeping the
+    // histogram of each of its columns.
+    struct hog_window_row window[HOG_WINDOW];
+    for (int i = 0; i < HOG_WINDOW; i++) {
+        int window_y = y - HOG_RADIUS + i;
+        window_y = window_y < 0 ? 0 :
+            window_y >= img->h ? img->h - 1 : window_y;
+
+        window[i].above = luma_row(img, luma_plane, window_y - 1);
+        window[i].row = luma_row(img, luma_plane, window_y);
+        window[i].below = luma_row(img, luma_plane, window_y + 1);
+    }
+
+    const unsigned char *above = image_row(img, y - 1);
+    const unsigned char *row = image_row(img, y);
+    const unsigned char *below = image_row(img, y + 1);
+
+    int columns[HOG_WINDOW][HOG_BINS];
+    int histogram[HOG_BINS] = { 0 };
+    for (int i = 0; i < HOG_WINDOW - 1; i++) {
+        oriented_gradient_column(img, window, x0 - HOG_RADIUS + i, columns[i]);
+        for (int bin = 0; bin < HOG_BINS; bin++) {
+            histogram[bin] += columns[i][bin];
+        }
+    }
+
+    int oldest = 0;
+    for (int x = x0; x < x1; x++) {
+        int *entering = columns[(oldest + HOG_WINDOW - 1) % HOG_WINDOW];
+        oriented_gradient_column(img, window, x + HOG_RADIUS, entering);
+        for (int bin = 0; bin < HOG_BINS; bin++) {
+            histogram[bin] += entering[bin];
+        }
+
+        energy_row[x] = hog_weighted(
+                POINT_ENERGY(gradient_energy, img, above, row, below, x),
+                histogram);
+
+        for (int bin = 0; bin < HOG_BINS; bin++) {
+            histogram[bin] -= columns[oldest][bin];
+        }
+        oldest = oldest + 1 < HOG_WINDOW ? oldest + 1 : 0;
+    }
+}
+
+static unsigned int hog_energy_at(
+        const struct image_view *img,
+        unsigned int gradient,
+        int x,
+        int y) {
+    int histogram[HOG_BINS] = { 0 };
+    for (int dy = -HOG_RADIUS; dy <= HOG_RADIUS; dy++)
+    for (int dx = -HOG_RADIUS; dx <= HOG_RADIUS; dx++) {
+        int row = y + dy;
+        row = row < 0 ? 0 : row >= img->h ? img->h - 1 : row;
+        add_oriented_gradient(img, clamp_column(img, x + dx), row, histogram);
+    }
+
+    return hog_weighted(gradient, histogram);
+}
+
+// DISPATCH ///////////////////////////////////////////////////////////////////
+
+void energy_span(
+        enum carver_energy energy,
+        const struct image_view *img,
+        const unsigned char *luma_plane,
+        int y,
+        int x0,
+        int x1,
+        unsigned int *energy_row) {
+    switch (energy) {
+        case CARVER_L1_GRADIENT_ENERGY:
+            l1_gradient_energy_span(img, y, x0, x1, energy_row);
+            break;
+        case CARVER_LUMA_GRADIENT_ENERGY:
+            luma_gradient_energy_span(img, luma_plane, y, x0, x1, energy_row);
+            break;
+        case CARVER_SOBEL_ENERGY:
+            sobel_energy_span(img, y, x0, x1, energy_row);
+            break;
+        case CARVER_SCHARR_ENERGY:
+            scharr_energy_span(img, y, x0, x1, energy_row);
+            break;
+        case CARVER_ENTROPY_ENERGY:
+            entropy_energy_span(img, luma_plane, y, x0, x1, energy_row);
+            break;
+        case CARVER_HOG_ENERGY:
+            hog_energy_span(img, luma_plane, y, x0, x1, energy_row);
+            break;
+        default:
+            gradient_energy_span(img, y, x0, x1, energy_row);
+            break;
+    }
+}
+
+int energy_max_seam_length(enum carver_energy energy) {
+    unsigned int max_energy;
+    switch (energy) {
+        case CARVER_L1_GRADIENT_ENERGY:
+            max_energy = 3 * 2 * 255;
+            break;
+        case CARVER_LUMA_GRADIENT_ENERGY:
+            max_energy = 2 * 255 * 255;
+            break;
+        case CARVER_ENTROPY_ENERGY:
+            max_energy = MAX_GRADIENT_ENERGY + entropy_terms[ENTROPY_PIXELS];
+            break;
+        default:
+            // The HOG energy only ever scales the gradient energy down.
+            max_energy = MAX_GRADIENT_ENERGY;
+            break;
+    }
+
+    // The seam links use UINT_MAX as a sentinel, which a seam must stay
+    // below.
+    return (UINT_MAX - 1) / max_energy;
+}
+
+int carver_reference_energy(
+        const struct image_view *img,
+        enum carver_energy energy,
+        unsigned int *energy_out) {
+    if (energy == CARVER_FORWARD_ENERGY) {
+        fprintf(stderr, "The forward energy has no energy per pixel\n");
+        return 1;
+    }
+
+    for (int y = 0; y < img->h; y++) {
+        const unsigned char *above = image_row(img, y - 1);
+        const unsigned char *row = image_row(img, y);
+        const unsigned char *below = image_row(img, y + 1);
+        unsigned int *energy_row = energy_out + y * img->stride;
+
+        for (int x = 0; x < img->w; x++) {
+            unsigned int gradient =
+                POINT_ENERGY(gradient_energy, img, above, row, below, x);
+
+            switch (energy) {
+                case CARVER_L1_GRADIENT_ENERGY:
+                    energy_row[x] = POINT_ENERGY(
+                            l1_gradient_energy,
+                            img,
+                            above,
+                            row,
+                            below,
+                            x);
+                    break;
+                case CARVER_LUMA_GRADIENT_ENERGY:
+                    energy_row[x] = POINT_ENERGY(
+                            luma_gradient_energy,
+                            img,
+                            above,
+                            row,
+                            below,
+                            x);
+                    break;
+                case CARVER_SOBEL_ENERGY:
+                    energy_row[x] = POINT_ENERGY(
+                            sobel_energy,
+                            img,
+                            above,
+                            row,
+                            below,
+                            x);
+                    break;
+                case CARVER_SCHARR_ENERGY:
+                    energy_row[x] = POINT_ENERGY(
+                            scharr_energy,
+                            img,
+                            above,
+                            row,
+                            below,
+                            x);
+                    break;
+                case CARVER_ENTROPY_ENERGY:
+                    energy_row[x] = gradient + entropy_energy_at(img, x, y);
+                    break;
+                case CARVER_HOG_ENERGY:
+                    energy_row[x] = hog_energy_at(img, gradient, x, y);
+                    break;
+                default:
+                    energy_row[x] = gradient;
+                    break;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include "carver.h"
+
+// The energy functions measuring the cost of removing each pixel, except for
+// the forward energy, which is computed while finding the seams instead.
+//
+// Each energy function has its own loop over a span of a row, with the
+// kernel inlined, so choosing an energy function costs one branch per span
+// rather than a call per pixel. Every loop computes exactly the same values
+// as `carver_reference_energy`, which evaluates the definition of each
+// energy one pixel at a time.
+
+// Whether the energy is computed from the brightness of the pixels, which
+// is then read from a plane with one byte per pixel, using the same stride as
+// the image.
+int energy_uses_luma(enum carver_energy energy);
+
+// Computes the brightness of rows [y0, y1) of `img` into `luma_plane`.
+void energy_luma_rows(
+        const struct image_view *img,
+        int y0,
+        int y1,
+        unsigned char *luma_plane);
+
+// The length of the longest seam whose cumulative energy is guaranteed to
+// fit an unsigned int, given the largest energy a pixel can have. For the
+// forward energy, the largest cost of a step is used instead.
+int energy_max_seam_length(enum carver_energy energy);
+
+// Computes the energy of row y of `img` in [x0, x1), into `energy_row`
+// indexed by column. `energy` must not be the forward energy. `luma_plane` is
+// the brightness of `img` if the energy uses it, and is ignored otherwise.
+void energy_span(
+        enum carver_energy energy,
+        const struct image_view *img,
+        const unsigned char *luma_plane,
+        int y,
+        int x0,
+        int x1,
+        unsigned int *energy_row);
+
+#endif
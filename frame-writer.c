@@ -0,0 +1,642 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stb_image_write.h"
+
+#include "frame-writer.h"
+#include "trace.h"
+
+// SNAPSHOTS //////////////////////////////////////////////////////////////////
+
+struct frame_snapshot {
+    atomic_int refcount;
+
+    int w;
+    int h;
+
+    // Contiguous RGB pixels.
+    unsigned char data[];
+};
+
+struct frame_snapshot * frame_snapshot_create(
+        const unsigned char *data,
+        int w,
+        int h,
+        int stride) {
+    struct frame_snapshot *snapshot =
+        malloc(sizeof(struct frame_snapshot) + w * h * 3);
+    if (!snapshot) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return NULL;
+    }
+
+    atomic_init(&snapshot->refcount, 1);
+    snapshot->w = w;
+    snapshot->h = h;
+
+    for (int y = 0; y < h; y++) {
+        memcpy(snapshot->data + y * w * 3, data + y * stride * 3, w * 3);
+    }
+
+    return snapshot;
+}
+
+void frame_snapshot_retain(struct frame_snapshot *snapshot) {
+    atomic_fetch_add(&snapshot->refcount, 1);
+}
+
+void frame_snapshot_release(struct frame_snapshot *snapshot) {
+    if (snapshot && atomic_fetch_sub(&snapshot->refcount, 1) == 1) {
+        free(snapshot);
+    }
+}
+
+// WRITER /////////////////////////////////////////////////////////////////////
+
+struct frame_job {
+    struct frame_snapshot *snapshot;
+
+    enum seam_direction direction;
+    int *seams;
+    int num_seams;
+
+    // The JPEG file to write, or an empty string to write the frame to the
+    // YUV4MPEG2 stream instead.
+    char filename[1024];
+
+    // Frames are written in increasing order of sequence numbers.
+    int sequence;
+
+    struct frame_job *next;
+};
+
+struct frame_writer {
+    pthread_mutex_t mutex;
+
+    // Signaled when a job is queued, or when the writer is shutting down.
+    pthread_cond_t job_available;
+
+    // Signaled when a frame is written, freeing up room for another one, and
+    // making it the next frame's turn to be written.
+    pthread_cond_t frame_written;
+
+    struct frame_job *queue_head;
+    struct frame_job *queue_tail;
+
+    // The number of frames queued or being encoded.
+    int num_pending;
+    int max_pending;
+
+    int next_sequence;
+    int next_sequence_to_write;
+
+    int shutting_down;
+    int failed;
+
+    pthread_t *threads;
+    int num_threads;
+
+    // The YUV4MPEG2 stream, if any. Every frame in the stream has the same
+    // size, with the image at the top-left and the rest of the frame black.
+    FILE *stream;
+    int stream_w;
+    int stream_h;
+
+    // May be NULL.
+    struct trace *trace;
+};
+
+struct encoded_frame {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    int failed;
+};
+
+static void append_encoded_data(void *context, void *data, int size) {
+    struct encoded_frame *frame = context;
+    if (frame->failed) { return; }
+
+    if (frame->size + size > frame->capacity) {
+        size_t capacity = frame->capacity ? frame->capacity * 2 : 65536;
+        while (capacity < frame->size + size) { capacity *= 2; }
+
+        unsigned char *grown = realloc(frame->data, capacity);
+        if (!grown) {
+            frame->failed = 1;
+            return;
+        }
+
+        frame->data = grown;
+        frame->capacity = capacity;
+    }
+
+    memcpy(frame->data + frame->size, data, size);
+    frame->size += size;
+}
+
+static void rgb_to_yuv(
+        const unsigned char *pixel,
+        unsigned char *y,
+        unsigned char *u,
+        unsigned char *v) {
+    // Full-range BT.601, as used by JPEG. The chroma is offset by 128 before
+    // shifting, which keeps the intermediate values positive.
+    int r = pixel[0];
+    int g = pixel[1];
+    int b = pixel[2];
+
+    *y = (77 * r + 150 * g + 29 * b + 128) >> 8;
+    *u = (-43 * r - 85 * g + 128 * b + 128 * 256 + 128) >> 8;
+    *v = (128 * r - 107 * g - 21 * b + 128 * 256 + 128) >> 8;
+}
+
+static int encode_y4m_frame(
+        const unsigned char *data,
+        int w,
+        int h,
+        int stream_w,
+        int stream_h,
+        struct encoded_frame *encoded) {
+    // 4:2:0 chroma subsampling, with each chroma sample averaging the RGB
+    // values of the 2x2 block of pixels it covers. Pixels outside the image
+    // count as black.
+    int chroma_w = stream_w / 2;
+    int chroma_h = stream_h / 2;
+
+    static const char frame_header[] = "FRAME\n";
+    size_t header_size = sizeof(frame_header) - 1;
+
+    encoded->size =
+        header_size + stream_w * stream_h + 2 * chroma_w * chroma_h;
+    encoded->capacity = encoded->size;
+    encoded->data = malloc(encoded->size);
+    if (!encoded->data) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return 1;
+    }
+
+    memcpy(encoded->data, frame_header, header_size);
+    unsigned char *y_plane = encoded->data + header_size;
+    unsigned char *u_plane = y_plane + stream_w * stream_h;
+    unsigned char *v_plane = u_plane + chroma_w * chroma_h;
+
+    static const unsigned char black[3] = { 0, 0, 0 };
+    unsigned char u, v;
+
+    for (int y = 0; y < stream_h; y++)
+    for (int x = 0; x < stream_w; x++) {
+        const unsigned char *pixel =
+            x < w && y < h ? data + (y * w + x) * 3 : black;
+        rgb_to_yuv(pixel, &y_plane[y * stream_w + x], &u, &v);
+    }
+
+    for (int cy = 0; cy < chroma_h; cy++)
+    for (int cx = 0; cx < chroma_w; cx++) {
+        int sum[3] = { 0, 0, 0 };
+
+        for (int dy = 0; dy < 2; dy++)
+        for (int dx = 0; dx < 2; dx++) {
+            int x = cx * 2 + dx;
+            int y = cy * 2 + dy;
+            if (x >= w || y >= h) { continue; }
+
+            const unsigned char *pixel = data + (y * w + x) * 3;
+            sum[0] += pixel[0];
+            sum[1] += pixel[1];
+            sum[2] += pixel[2];
+        }
+
+        unsigned char average[3] = {
+            (sum[0] + 2) / 4,
+            (sum[1] + 2) / 4,
+            (sum[2] + 2) / 4
+        };
+        unsigned char luma;
+        rgb_to_yuv(
+                average,
+                &luma,
+                &u_plane[cy * chroma_w + cx],
+                &v_plane[cy * chroma_w + cx]);
+    }
+
+    return 0;
+}
+
+static int encode_frame(
+        const struct frame_writer *writer,
+        const struct frame_job *job,
+        struct encoded_frame *encoded) {
+    struct frame_snapshot *snapshot = job->snapshot;
+    int w = snapshot->w;
+    int h = snapshot->h;
+
+    // The seams can be drawn directly on the snapshot if nothing else holds
+    // on to it. Otherwise, the drawing happens on a private copy.
+    unsigned char *data = snapshot->data;
+    if (atomic_load(&snapshot->refcount) > 1) {
+        data = malloc(w * h * 3);
+        if (!data) {
+            fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+            return 1;
+        }
+
+        memcpy(data, snapshot->data, w * h * 3);
+    }
+
+    int seam_length = job->direction == VERTICAL_SEAMS ? h : w;
+    for (int seam = 0; seam < job->num_seams; seam++)
+    for (int d = 0; d < seam_length; d++) {
+        int coordinate = job->seams[seam * seam_length + d];
+        int x = job->direction == VERTICAL_SEAMS ? coordinate : w - 1 - d;
+        int y = job->direction == VERTICAL_SEAMS ? h - 1 - d : coordinate;
+        int i = (y * w + x) * 3;
+
+        data[i    ] = 255;
+        data[i + 1] = 0;
+        data[i + 2] = 0;
+    }
+
+    int result;
+    if (job->filename[0]) {
+        result = !stbi_write_jpg_to_func(
+                append_encoded_data,
+                encoded,
+                w,
+                h,
+                3,
+                data,
+                80) || encoded->failed;
+    } else {
+        result = encode_y4m_frame(
+                data,
+                w,
+                h,
+                writer->stream_w,
+                writer->stream_h,
+                encoded);
+    }
+
+    if (data != snapshot->data) { free(data); }
+
+    return result;
+}
+
+static int write_encoded_frame(
+        const struct frame_writer *writer,
+        const char *filename,
+        const struct encoded_frame *encoded) {
+    if (!filename[0]) {
+        return fwrite(encoded->data, 1, encoded->size, writer->stream) !=
+            encoded->size;
+    }
+
+    printf("Writing to '%s'\n", filename);
+
+    FILE *file = fopen(filename, "wb");
+    int result = !file || fwrite(encoded->data, 1, encoded->size, file) !=
+        encoded->size;
+    if (file && fclose(file)) { result = 1; }
+
+    return result;
+}
+
+static void free_job(struct frame_job *job) {
+    frame_snapshot_release(job->snapshot);
+    if (job->seams) { free(job->seams); }
+    free(job);
+}
+
+static void process_job(struct frame_writer *writer, struct frame_job *job) {
+    struct encoded_frame encoded = { 0 };
+    unsigned long long start = trace_begin(writer->trace);
+    int failed = encode_frame(writer, job, &encoded);
+    trace_end(
+            writer->trace,
+            TRACE_ENCODE,
+            job->sequence,
+            start,
+            (long long) job->snapshot->w * job->snapshot->h,
+            encoded.capacity);
+
+    // Jobs are taken off the queue in order, so the frames before this one
+    // are already being encoded and will eventually be written.
+    pthread_mutex_lock(&writer->mutex);
+    while (writer->next_sequence_to_write != job->sequence) {
+        pthread_cond_wait(&writer->frame_written, &writer->mutex);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+
+    if (!failed) {
+        start = trace_begin(writer->trace);
+        failed = write_encoded_frame(writer, job->filename, &encoded);
+        trace_end(writer->trace, TRACE_WRITE, job->sequence, start, 0, 0);
+    }
+
+    if (failed) {
+        fprintf(
+                stderr,
+                "Unable to write '%s'\n",
+                job->filename[0] ? job->filename : "video stream");
+    }
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->failed |= failed;
+    writer->next_sequence_to_write++;
+    writer->num_pending--;
+    pthread_cond_broadcast(&writer->frame_written);
+    pthread_mutex_unlock(&writer->mutex);
+
+    if (encoded.data) { free(encoded.data); }
+    free_job(job);
+}
+
+static void * run_encoder_thread(void *context) {
+    struct frame_writer *writer = context;
+
+    for (;;) {
+        pthread_mutex_lock(&writer->mutex);
+        while (!writer->queue_head && !writer->shutting_down) {
+            pthread_cond_wait(&writer->job_available, &writer->mutex);
+        }
+
+        struct frame_job *job = writer->queue_head;
+        if (!job) {
+            pthread_mutex_unlock(&writer->mutex);
+            return NULL;
+        }
+
+        writer->queue_head = job->next;
+        if (!writer->queue_head) { writer->queue_tail = NULL; }
+        pthread_mutex_unlock(&writer->mutex);
+
+        process_job(writer, job);
+    }
+}
+
+struct frame_writer * frame_writer_create(
+        int num_threads,
+        int max_pending_frames) {
+    struct frame_writer *writer = calloc(1, sizeof(struct frame_writer));
+    if (!writer) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return NULL;
+    }
+
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->job_available, NULL);
+    pthread_cond_init(&writer->frame_written, NULL);
+    writer->max_pending = max_pending_frames;
+
+    writer->threads = malloc((num_threads + 1) * sizeof(pthread_t));
+    if (!writer->threads) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        frame_writer_finish(writer);
+        return NULL;
+    }
+
+    for (; writer->num_threads < num_threads; writer->num_threads++) {
+        if (pthread_create(
+                    &writer->threads[writer->num_threads],
+                    NULL,
+                    run_encoder_thread,
+                    writer)) {
+            fprintf(stderr, "Unable to start thread (%d)\n", __LINE__);
+
+            frame_writer_finish(writer);
+            return NULL;
+        }
+    }
+
+    return writer;
+}
+
+void frame_writer_set_trace(
+        struct frame_writer *writer,
+        struct trace *trace) {
+    writer->trace = trace;
+}
+
+FILE * frame_writer_open_stream(const char *filename) {
+    if (strcmp(filename, "-") != 0) {
+        FILE *stream = fopen(filename, "wb");
+        if (!stream) { fprintf(stderr, "Unable to open '%s'\n", filename); }
+
+        return stream;
+    }
+
+    // The video stream takes over standard output, so everything else that
+    // would normally be printed there goes to standard error.
+    FILE *stream = NULL;
+    int stream_fd = dup(STDOUT_FILENO);
+    if (stream_fd < 0 ||
+            !(stream = fdopen(stream_fd, "wb")) ||
+            dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "Unable to open standard output\n");
+
+        if (stream) {
+            fclose(stream);
+        } else if (stream_fd >= 0) {
+            close(stream_fd);
+        }
+        return NULL;
+    }
+
+    return stream;
+}
+
+int frame_writer_open_y4m(
+        struct frame_writer *writer,
+        FILE *stream,
+        int w,
+        int h) {
+    writer->stream = stream;
+    writer->stream_w = (w + 1) / 2 * 2;
+    writer->stream_h = (h + 1) / 2 * 2;
+
+    // Frames are shown at 10 frames per second. C420jpeg only sets the
+    // chroma siting of the 4:2:0 planes, centered between the luma samples.
+    // Readers assume limited range unless told otherwise, so XCOLORRANGE
+    // marks the frames as full range, which is what `rgb_to_yuv` produces.
+    if (fprintf(
+                stream,
+                "YUV4MPEG2 W%d H%d F10:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n",
+                writer->stream_w,
+                writer->stream_h) < 0) {
+        fprintf(stderr, "Unable to write video stream (%d)\n", __LINE__);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int queue_seams(
+        struct frame_writer *writer,
+        struct frame_snapshot *snapshot,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams,
+        const char *filename) {
+    struct frame_job *job = calloc(1, sizeof(struct frame_job));
+    if (!job) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return 1;
+    }
+
+    int seam_length = direction == VERTICAL_SEAMS ? snapshot->h : snapshot->w;
+    job->seams = malloc(num_seams * seam_length * sizeof(int));
+    if (!job->seams) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        free(job);
+        return 1;
+    }
+
+    memcpy(job->seams, seams, num_seams * seam_length * sizeof(int));
+    job->direction = direction;
+    job->num_seams = num_seams;
+    snprintf(job->filename, sizeof(job->filename), "%s", filename);
+
+    frame_snapshot_retain(snapshot);
+    job->snapshot = snapshot;
+
+    pthread_mutex_lock(&writer->mutex);
+    while (writer->num_pending >= writer->max_pending && !writer->failed) {
+        pthread_cond_wait(&writer->frame_written, &writer->mutex);
+    }
+
+    if (writer->failed) {
+        pthread_mutex_unlock(&writer->mutex);
+
+        free_job(job);
+        return 1;
+    }
+
+    job->sequence = writer->next_sequence++;
+    writer->num_pending++;
+
+    if (writer->num_threads == 0) {
+        // Without any encoder threads, the frame is written right away.
+        pthread_mutex_unlock(&writer->mutex);
+
+        process_job(writer, job);
+        return writer->failed;
+    }
+
+    if (writer->queue_tail) {
+        writer->queue_tail->next = job;
+    } else {
+        writer->queue_head = job;
+    }
+    writer->queue_tail = job;
+
+    pthread_cond_signal(&writer->job_available);
+    pthread_mutex_unlock(&writer->mutex);
+
+    return 0;
+}
+
+int frame_writer_write_seams(
+        struct frame_writer *writer,
+        struct frame_snapshot *snapshot,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams,
+        const char *filename) {
+    return queue_seams(
+            writer,
+            snapshot,
+            direction,
+            seams,
+            num_seams,
+            filename);
+}
+
+int frame_writer_stream_seams(
+        struct frame_writer *writer,
+        struct frame_snapshot *snapshot,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams) {
+    return queue_seams(writer, snapshot, direction, seams, num_seams, "");
+}
+
+int frame_writer_write_iteration(
+        struct frame_writer *writer,
+        const unsigned char *data,
+        int w,
+        int h,
+        int stride,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams,
+        const char *output_directory,
+        int iteration) {
+    // The image may keep changing in place, so the frame gets its own
+    // snapshot of it.
+    struct frame_snapshot *snapshot =
+        frame_snapshot_create(data, w, h, stride);
+    if (!snapshot) { return 1; }
+
+    int result;
+    if (writer->stream) {
+        result = frame_writer_stream_seams(
+                writer,
+                snapshot,
+                direction,
+                seams,
+                num_seams);
+    } else {
+        char output_filename[1024];
+        snprintf(
+                output_filename,
+                1024,
+                "%s/img-seam-%04d.jpg",
+                output_directory,
+                iteration);
+
+        result = frame_writer_write_seams(
+                writer,
+                snapshot,
+                direction,
+                seams,
+                num_seams,
+                output_filename);
+    }
+    frame_snapshot_release(snapshot);
+
+    return result;
+}
+
+int frame_writer_finish(struct frame_writer *writer) {
+    if (!writer) { return 0; }
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->shutting_down = 1;
+    pthread_cond_broadcast(&writer->job_available);
+    pthread_mutex_unlock(&writer->mutex);
+
+    // The threads drain the queue before exiting.
+    for (int i = 0; i < writer->num_threads; i++) {
+        pthread_join(writer->threads[i], NULL);
+    }
+
+    int result = writer->failed;
+    if (writer->stream && fflush(writer->stream)) {
+        fprintf(stderr, "Unable to write video stream (%d)\n", __LINE__);
+        result = 1;
+    }
+
+    pthread_mutex_destroy(&writer->mutex);
+    pthread_cond_destroy(&writer->job_available);
+    pthread_cond_destroy(&writer->frame_written);
+    if (writer->threads) { free(writer->threads); }
+    free(writer);
+
+    return result;
+}
@@ -0,0 +1,105 @@
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include <stdio.h>
+
+#include "seams.h"
+
+// Encodes and writes the seam visualization frames on a pool of background
+// threads, so the carving doesn't wait on the encoder. Frames are written
+// either as individual JPEGs, or as a single YUV4MPEG2 video stream.
+//
+// Each frame is a reference-counted snapshot of the image, along with the
+// seams to draw on top of it. Frames are encoded in parallel, but always
+// written out in the order they were submitted. The number of frames waiting
+// to be written is bounded: submitting a frame blocks until there is room,
+// which caps the memory used by the snapshots.
+
+struct frame_snapshot;
+struct frame_writer;
+struct trace;
+
+// Copies an RGB image, with `stride` pixels from the start of one row to the
+// start of the next, into a new snapshot with a reference count of 1.
+struct frame_snapshot * frame_snapshot_create(
+        const unsigned char *data,
+        int w,
+        int h,
+        int stride);
+
+void frame_snapshot_retain(struct frame_snapshot *snapshot);
+void frame_snapshot_release(struct frame_snapshot *snapshot);
+
+// Starts `num_threads` encoder threads. At most `max_pending_frames` frames
+// can be queued or in the middle of being encoded at any time. With no
+// threads, each frame is encoded and written before the call submitting it
+// returns.
+struct frame_writer * frame_writer_create(
+        int num_threads,
+        int max_pending_frames);
+
+// Times the encoding and the writing of every following frame in `trace`,
+// numbering the frames in the order they were submitted.
+void frame_writer_set_trace(
+        struct frame_writer *writer,
+        struct trace *trace);
+
+// Opens `filename` for writing a video stream to, or standard output if
+// `filename` is "-". In the latter case, anything else printed to standard
+// output is redirected to standard error from then on. Returns NULL on error.
+FILE * frame_writer_open_stream(const char *filename);
+
+// Writes the YUV4MPEG2 stream header to `stream`, which is then used for the
+// frames submitted with `frame_writer_stream_seams`. Every frame in the
+// stream is `w` by `h`, rounded up to even dimensions, with smaller images
+// padded on the right and bottom with black. The stream stays open when the
+// writer is finished.
+int frame_writer_open_y4m(
+        struct frame_writer *writer,
+        FILE *stream,
+        int w,
+        int h);
+
+// Queues a frame showing the given seams in red, to be written as a JPEG to
+// `filename`. The seams are laid out as described in `seams.h` and are
+// copied. The snapshot is retained until the frame is written. Returns
+// non-zero on error, including if a previous frame failed to be written.
+int frame_writer_write_seams(
+        struct frame_writer *writer,
+        struct frame_snapshot *snapshot,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams,
+        const char *filename);
+
+// Like `frame_writer_write_seams`, but appends the frame to the YUV4MPEG2
+// stream instead of writing a JPEG.
+int frame_writer_stream_seams(
+        struct frame_writer *writer,
+        struct frame_snapshot *snapshot,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams);
+
+// Snapshots an RGB image laid out as in `frame_snapshot_create`, and queues
+// the frame of one iteration showing the given seams. The frame is appended
+// to the video stream if `frame_writer_open_y4m` was called, and otherwise
+// written as a JPEG to `<output_directory>/img-seam-<iteration>.jpg`.
+// Returns non-zero on error.
+int frame_writer_write_iteration(
+        struct frame_writer *writer,
+        const unsigned char *data,
+        int w,
+        int h,
+        int stride,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams,
+        const char *output_directory,
+        int iteration);
+
+// Waits for every queued frame to be written, then stops the threads and
+// frees the writer. Returns non-zero if any frame failed to be written.
+int frame_writer_finish(struct frame_writer *writer);
+
+#endif
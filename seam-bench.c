@@ -0,0 +1,877 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "carver.h"
+#include "simd.h"
+#include "thread-pool.h"
+#include "trace.h"
+
+// Times each stage of the carving on synthetic images of several sizes and
+// aspect ratios, and optionally compares the results against a baseline
+// written by a previous run, to catch performance regressions.
+//
+// The stages are timed with the same trace as `seam-carver --trace`, one
+// span per stage and iteration, from which the median, the 95th percentile
+// and the throughput of each stage are computed.
+
+// CASES //////////////////////////////////////////////////////////////////////
+
+struct bench_case {
+    const char *name;
+    int w;
+    int h;
+    enum carver_energy energy;
+
+    // Finds the seams coarse to fine when above 0.
+    int pyramid_levels;
+};
+
+// The corridor radius of the cases using a pyramid.
+#define BENCH_CORRIDOR_RADIUS 16
+
+static const struct bench_case bench_cases[] = {
+    { "0.25mp-square", 512, 512, CARVER_GRADIENT_ENERGY },
+    { "0.25mp-tall", 256, 1024, CARVER_GRADIENT_ENERGY },
+    { "1mp-square", 1024, 1024, CARVER_GRADIENT_ENERGY },
+    { "1mp-square-l1", 1024, 1024, CARVER_L1_GRADIENT_ENERGY },
+    { "1mp-square-luma", 1024, 1024, CARVER_LUMA_GRADIENT_ENERGY },
+    { "1mp-square-sobel", 1024, 1024, CARVER_SOBEL_ENERGY },
+    { "1mp-square-scharr", 1024, 1024, CARVER_SCHARR_ENERGY },
+    { "1mp-square-entropy", 1024, 1024, CARVER_ENTROPY_ENERGY },
+    { "1mp-square-hog", 1024, 1024, CARVER_HOG_ENERGY },
+    { "1mp-square-forward", 1024, 1024, CARVER_FORWARD_ENERGY },
+    { "1mp-wide", 1344, 768, CARVER_GRADIENT_ENERGY },
+    { "4mp-wide", 2688, 1536, CARVER_GRADIENT_ENERGY },
+    { "4mp-tall", 1024, 4096, CARVER_GRADIENT_ENERGY },
+    { "16mp-square", 4096, 4096, CARVER_GRADIENT_ENERGY },
+    { "16mp-square-pyramid", 4096, 4096, CARVER_GRADIENT_ENERGY, 3 },
+    { "16mp-panorama", 16384, 1024, CARVER_GRADIENT_ENERGY },
+    { "100mp-square", 10000, 10000, CARVER_GRADIENT_ENERGY }
+};
+
+#define NUM_BENCH_CASES (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+// How much larger than --max-megapixels a case may be, so the limit matches
+// the sizes in the case names.
+#define BENCH_MEGAPIXELS_ROOM 1.05
+
+// The stages reported for each case, in order, when the case has any span of
+// them. The energy is computed along with the seam links, one row at a time,
+// so it has no stage of its own.
+static const enum trace_stage bench_stages[] = {
+    TRACE_SEAM_LINKS,
+    TRACE_SEAMS,
+    TRACE_PYRAMID,
+    TRACE_REMOVAL,
+    TRACE_ENCODE
+};
+
+#define NUM_BENCH_STAGES (sizeof(bench_stages) / sizeof(bench_stages[0]))
+
+void generate_image(unsigned char *data, int w, int h) {
+    // A smooth gradient with a few hard-edged discs, over a band of noise at
+    // the bottom, so the energy has both flat and busy areas. The noise
+    // comes from a fixed seed, so every run carves the same image.
+    unsigned int state = 0x9e3779b9;
+    int radius = (w < h ? w : h) / 8;
+
+    for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++) {
+        unsigned char *pixel = data + ((size_t) y * w + x) * 3;
+        pixel[0] = (long long) x * 255 / w;
+        pixel[1] = (long long) y * 255 / h;
+        pixel[2] = 128;
+
+        for (int disc = 0; disc < 3; disc++) {
+            long long dx = x - (long long) w * (disc + 1) / 4;
+            long long dy = y - h / 3;
+            if (dx * dx + dy * dy < (long long) radius * radius) {
+                pixel[0] = 40 + disc * 80;
+                pixel[1] = 200 - disc * 60;
+                pixel[2] = 30;
+            }
+        }
+
+        if (y >= h * 2 / 3) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+
+            for (int c = 0; c < 3; c++) {
+                pixel[c] = (pixel[c] >> 1) + ((state >> (c * 8)) & 127);
+            }
+        }
+    }
+}
+
+int clamp(int value, int min, int max) {
+    return value < min ? min : value > max ? max : value;
+}
+
+// BASELINE ///////////////////////////////////////////////////////////////////
+
+// The results are written as JSON, with one result per line, so a baseline
+// written by this program can be read back without a full JSON parser.
+
+struct bench_result {
+    char case_name[64];
+    char stage_name[32];
+    struct trace_stage_stats stats;
+};
+
+struct bench_results {
+    int threads;
+    char simd[16];
+
+    struct bench_result results[NUM_BENCH_CASES * NUM_BENCH_STAGES];
+    int num_results;
+};
+
+int write_bench_results(
+        const struct bench_results *results,
+        const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Unable to write '%s'\n", filename);
+        return 1;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"threads\": %d,\n", results->threads);
+    fprintf(file, "  \"simd\": \"%s\",\n", results->simd);
+    fprintf(file, "  \"results\": [\n");
+    for (int i = 0; i < results->num_results; i++) {
+        const struct bench_result *result = &results->results[i];
+
+        fprintf(
+                file,
+                "    {\"case\": \"%s\", \"stage\": \"%s\", \"samples\": %d, "
+                "\"median_ms\": %.4f, \"p95_ms\": %.4f, "
+                "\"mp_per_s\": %.2f}%s\n",
+                result->case_name,
+                result->stage_name,
+                result->stats.num_spans,
+                result->stats.median,
+                result->stats.p95,
+                result->stats.throughput,
+                i + 1 < results->num_results ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+
+    if (fclose(file)) {
+        fprintf(stderr, "Unable to write '%s'\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+int read_bench_results(const char *filename, struct bench_results *results) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Unable to read '%s'\n", filename);
+        return 1;
+    }
+
+    memset(results, 0, sizeof(struct bench_results));
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        if (results->num_results == NUM_BENCH_CASES * NUM_BENCH_STAGES) {
+            break;
+        }
+
+        struct bench_result *result = &results->results[results->num_results];
+        if (sscanf(line, " \"threads\": %d", &results->threads) == 1 ||
+                sscanf(line, " \"simd\": \"%15[^\"]\"", results->simd) == 1) {
+            continue;
+        }
+
+        if (sscanf(
+                    line,
+                    " {\"case\": \"%63[^\"]\", \"stage\": \"%31[^\"]\", "
+                    "\"samples\": %d, \"median_ms\": %lf, \"p95_ms\": %lf, "
+                    "\"mp_per_s\": %lf",
+                    result->case_name,
+                    result->stage_name,
+                    &result->stats.num_spans,
+                    &result->stats.median,
+                    &result->stats.p95,
+                    &result->stats.throughput) == 6) {
+            results->num_results++;
+        }
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+const struct bench_result * find_bench_result(
+        const struct bench_results *results,
+        const char *case_name,
+        const char *stage_name) {
+    for (int i = 0; i < results->num_results; i++) {
+        if (strcmp(results->results[i].case_name, case_name) == 0 &&
+                strcmp(results->results[i].stage_name, stage_name) == 0) {
+            return &results->results[i];
+        }
+    }
+
+    return NULL;
+}
+
+// ENERGY CHECK ///////////////////////////////////////////////////////////////
+
+// The carver computes each energy with its own optimized loop. Before timing
+// anything, the energy computed by the carver is compared against the
+// reference implementation, both on the original image and after removing a
+// few seams, so a faster loop can't silently change the results. Every seam
+// removed in between is also compared against the minimal seam of the
+// reference energy, which covers the energy folded into the seam links a
+// chunk at a time and the links kept up to date by incremental carvers.
+
+#define CHECK_WIDTH 301
+#define CHECK_HEIGHT 97
+#define CHECK_SEAMS 7
+
+// Wider than two chunks of the fused energy and seam links pass, without
+// being a multiple of the chunk width.
+#define CHECK_WIDE_WIDTH 2500
+#define CHECK_WIDE_HEIGHT 23
+
+struct energy_check {
+    enum carver_energy energy;
+
+    // Sized for the original image.
+    unsigned int *reference;
+    unsigned int *cumulative;
+    int *seam;
+};
+
+int check_energy_image(
+        struct carver *carver,
+        enum carver_energy energy,
+        unsigned int *reference) {
+    // Returns non-zero if the carver's energy differs from the reference.
+    const struct image_view *img = carver_image(carver);
+    const unsigned int *computed = carver_compute_energy(carver);
+    if (!computed || carver_reference_energy(img, energy, reference)) {
+        return 1;
+    }
+
+    for (int y = 0; y < img->h; y++)
+    for (int x = 0; x < img->w; x++) {
+        int i = y * img->stride + x;
+        if (computed[i] != reference[i]) {
+            fprintf(
+                    stderr,
+                    "The %s energy at (%d, %d) of a %dx%d image is %u "
+                    "instead of %u\n",
+                    carver_energy_name(energy),
+                    x,
+                    y,
+                    img->w,
+                    img->h,
+                    computed[i],
+                    reference[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void find_reference_seam(
+        const struct image_view *img,
+        const unsigned int *energy,
+        unsigned int *cumulative,
+        int *seam) {
+    // The minimal vertical seam, breaking ties towards the left like the
+    // carver does.
+    int w = img->w;
+    int h = img->h;
+
+    for (int x = 0; x < w; x++) { cumulative[x] = energy[x]; }
+
+    for (int y = 1; y < h; y++)
+    for (int x = 0; x < w; x++) {
+        const unsigned int *above = cumulative + (y - 1) * w;
+
+        unsigned int min_above = above[x];
+        if (x > 0 && above[x - 1] <= min_above) { min_above = above[x - 1]; }
+        if (x < w - 1 && above[x + 1] < min_above) {
+            min_above = above[x + 1];
+        }
+
+        cumulative[y * w + x] = energy[y * img->stride + x] + min_above;
+    }
+
+    int seamx = 0;
+    for (int x = 1; x < w; x++) {
+        if (cumulative[(h - 1) * w + x] < cumulative[(h - 1) * w + seamx]) {
+            seamx = x;
+        }
+    }
+
+    for (int y = h - 1; y >= 0; y--) {
+        seam[h - 1 - y] = seamx;
+        if (y == 0) { break; }
+
+        const unsigned int *above = cumulative + (y - 1) * w;
+
+        int parent = seamx;
+        if (seamx > 0 && above[seamx - 1] <= above[parent]) {
+            parent = seamx - 1;
+        }
+        if (seamx < w - 1 && above[seamx + 1] < above[parent]) {
+            parent = seamx + 1;
+        }
+        seamx = parent;
+    }
+}
+
+int check_seam(void *context, const struct carver_iteration *iteration) {
+    // Returns non-zero if the seam about to be removed isn't the minimal seam
+    // of the reference energy.
+    struct energy_check *check = context;
+    const struct image_view *img = iteration->img;
+
+    if (carver_reference_energy(img, check->energy, check->reference)) {
+        return 1;
+    }
+    find_reference_seam(img, check->reference, check->cumulative, check->seam);
+
+    for (int i = 0; i < img->h; i++) {
+        if (iteration->seams[i] != check->seam[i]) {
+            fprintf(
+                    stderr,
+                    "The seam of iteration %d on a %dx%d image with the %s "
+                    "energy is at x = %d instead of %d on row %d\n",
+                    iteration->iteration,
+                    img->w,
+                    img->h,
+                    carver_energy_name(check->energy),
+                    iteration->seams[i],
+                    check->seam[i],
+                    img->h - 1 - i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int check_energy_case(
+        enum carver_energy energy,
+        int w,
+        int h,
+        int incremental,
+        struct thread_pool *pool) {
+    // Returns non-zero if the energy or the seams differ from the reference.
+    int result = 0;
+
+    unsigned char *data = NULL;
+    struct energy_check check = { .energy = energy };
+    struct carver *carver = NULL;
+
+    data = malloc(w * h * 3);
+    check.reference = malloc(w * h * sizeof(unsigned int));
+    check.cumulative = malloc(w * h * sizeof(unsigned int));
+    check.seam = malloc(h * sizeof(int));
+    if (!data || !check.reference || !check.cumulative || !check.seam) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        result = 1;
+        goto cleanup;
+    }
+
+    generate_image(data, w, h);
+
+    carver = carver_create(
+            data,
+            w,
+            h,
+            energy,
+            incremental,
+            1,
+            0,
+            0,
+            0,
+            pool,
+            NULL);
+    if (!carver) {
+        result = 1;
+        goto cleanup;
+    }
+
+    carver_set_iteration_callback(carver, check_seam, &check);
+
+    if (check_energy_image(carver, energy, check.reference) ||
+            carver_remove_vertical_seams(carver, CHECK_SEAMS) ||
+            check_energy_image(carver, energy, check.reference)) {
+        result = 1;
+        goto cleanup;
+    }
+
+cleanup:
+    carver_free(carver);
+    if (data) { free(data); }
+    if (check.reference) { free(check.reference); }
+    if (check.cumulative) { free(check.cumulative); }
+    if (check.seam) { free(check.seam); }
+
+    return result;
+}
+
+int check_energy(enum carver_energy energy, struct thread_pool *pool) {
+    // Returns non-zero if the energy differs from its reference, with and
+    // without incremental carving where the energy supports it.
+    int max_incremental = carver_energy_is_incremental(energy) ? 1 : 0;
+
+    for (int incremental = 0; incremental <= max_incremental; incremental++) {
+        if (check_energy_case(
+                    energy,
+                    CHECK_WIDTH,
+                    CHECK_HEIGHT,
+                    incremental,
+                    pool) ||
+                check_energy_case(
+                    energy,
+                    CHECK_WIDE_WIDTH,
+                    CHECK_WIDE_HEIGHT,
+                    incremental,
+                    pool)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// RUNS ///////////////////////////////////////////////////////////////////////
+
+// Encoded images are only counted, not kept.
+void count_encoded_bytes(void *context, void *data, int size) {
+    (void) data;
+    *(long long *) context += size;
+}
+
+int run_bench_case(
+        const struct bench_case *bench_case,
+        struct thread_pool *pool,
+        struct bench_results *results) {
+    int result = 0;
+
+    unsigned char *data = NULL;
+    struct trace *trace = NULL;
+    struct carver *carver = NULL;
+
+    double megapixels = (double) bench_case->w * bench_case->h / 1e6;
+
+    // Enough iterations for stable statistics on the small images, without
+    // the large ones taking minutes. Each iteration recomputes everything,
+    // so every iteration is one sample of each carving stage.
+    int num_iterations = clamp(64 / megapixels, 5, 40);
+    int num_encodes = clamp(16 / megapixels, 1, 9);
+
+    data = malloc((size_t) bench_case->w * bench_case->h * 3);
+    trace = trace_create();
+    if (!data || !trace) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        result = 1;
+        goto cleanup;
+    }
+
+    generate_image(data, bench_case->w, bench_case->h);
+
+    carver = carver_create(
+            data,
+            bench_case->w,
+            bench_case->h,
+            bench_case->energy,
+            0,
+            1,
+            bench_case->pyramid_levels,
+            BENCH_CORRIDOR_RADIUS,
+            0,
+            pool,
+            trace);
+    if (!carver || carver_remove_vertical_seams(carver, num_iterations)) {
+        result = 1;
+        goto cleanup;
+    }
+
+    carver_compact_image(carver);
+    const struct image_view *img = carver_image(carver);
+
+    for (int i = 0; i < num_encodes; i++) {
+        long long encoded_bytes = 0;
+
+        unsigned long long start = trace_begin(trace);
+        stbi_write_jpg_to_func(
+                count_encoded_bytes,
+                &encoded_bytes,
+                img->w,
+                img->h,
+                3,
+                img->data,
+                80);
+        trace_end(
+                trace,
+                TRACE_ENCODE,
+                -1,
+                start,
+                (long long) img->w * img->h,
+                encoded_bytes);
+    }
+
+    for (int i = 0; i < NUM_BENCH_STAGES; i++) {
+        struct bench_result *stage_result =
+            &results->results[results->num_results];
+
+        snprintf(
+                stage_result->case_name,
+                sizeof(stage_result->case_name),
+                "%s",
+                bench_case->name);
+        snprintf(
+                stage_result->stage_name,
+                sizeof(stage_result->stage_name),
+                "%s",
+                trace_stage_name(bench_stages[i]));
+
+        if (trace_stage_stats(trace, bench_stages[i], &stage_result->stats)) {
+            result = 1;
+            goto cleanup;
+        }
+
+        if (stage_result->stats.num_spans > 0) { results->num_results++; }
+    }
+
+cleanup:
+    carver_free(carver);
+    trace_free(trace);
+    if (data) { free(data); }
+
+    return result;
+}
+
+// A stage only counts as a regression if its median also got slower by more
+// than this many milliseconds, since the stages taking microseconds are too
+// noisy for a relative threshold alone.
+#define BENCH_MIN_REGRESSION_MS 0.1
+
+int report_bench_case(
+        const struct bench_results *results,
+        int first_result,
+        const struct bench_results *baseline,
+        double tolerance) {
+    // Prints the results of one case, and returns the number of stages
+    // slower than the baseline by more than `tolerance`, in percent, and by
+    // more than BENCH_MIN_REGRESSION_MS.
+    int num_regressions = 0;
+
+    for (int i = first_result; i < results->num_results; i++) {
+        const struct bench_result *result = &results->results[i];
+
+        printf(
+                "  %-12s %8d %10.3f %10.3f %10.2f",
+                result->stage_name,
+                result->stats.num_spans,
+                result->stats.median,
+                result->stats.p95,
+                result->stats.throughput);
+
+        const struct bench_result *base = baseline ?
+            find_bench_result(
+                    baseline,
+                    result->case_name,
+                    result->stage_name) :
+            NULL;
+        if (base && base->stats.median > 0) {
+            double change =
+                100 * (result->stats.median / base->stats.median - 1);
+            int regressed = change > tolerance &&
+                result->stats.median - base->stats.median >
+                    BENCH_MIN_REGRESSION_MS;
+            num_regressions += regressed;
+
+            printf(
+                    " %+9.1f%%%s",
+                    change,
+                    regressed ? "  REGRESSION" : "");
+        } else if (baseline) {
+            printf(" %10s", "new");
+        }
+
+        printf("\n");
+    }
+
+    return num_regressions;
+}
+
+// MAIN ///////////////////////////////////////////////////////////////////////
+
+void show_usage(const char *program) {
+    fprintf(
+            stderr,
+            "USAGE:\n"
+            "  %s [options]\n"
+            "\n"
+            "OPTIONS:\n"
+            "  --output=<file>    write the results to <file> as JSON\n"
+            "  --baseline=<file>  compare the median time of each stage\n"
+            "                     against the results in <file>, written\n"
+            "                     by a previous run with --output\n"
+            "  --tolerance=<percent>\n"
+            "                     how much slower than the baseline a stage\n"
+            "                     can get before it counts as a regression,\n"
+            "                     if it also got more than 0.1 ms slower\n"
+            "                     (default: 20)\n"
+            "  --max-megapixels=<n>\n"
+            "                     skip the images larger than n megapixels,\n"
+            "                     as rounded in their names\n"
+            "  --threads=<n>      number of threads computing the energy and\n"
+            "                     finding the seams (default: the number of\n"
+            "                     CPUs)\n"
+            "  --simd=<level>     vector instruction set to use: scalar,\n"
+            "                     sse4.1, avx2 or avx512 (default: the\n"
+            "                     widest one supported by the CPU)\n",
+            program);
+}
+
+struct options {
+    const char *output_filename;
+    const char *baseline_filename;
+    double tolerance;
+    double max_megapixels;
+    int threads;
+    enum simd_level simd_level;
+};
+
+enum {
+    OPTION_OUTPUT = 256,
+    OPTION_BASELINE,
+    OPTION_TOLERANCE,
+    OPTION_MAX_MEGAPIXELS,
+    OPTION_THREADS,
+    OPTION_SIMD
+};
+
+int main(int argc, char **argv) {
+    struct options options = {
+        .output_filename = NULL,
+        .baseline_filename = NULL,
+        .tolerance = 20,
+        .max_megapixels = 0,
+        .threads = sysconf(_SC_NPROCESSORS_ONLN),
+        .simd_level = simd_detect()
+    };
+
+    static const struct option long_options[] = {
+        { "output", required_argument, NULL, OPTION_OUTPUT },
+        { "baseline", required_argument, NULL, OPTION_BASELINE },
+        { "tolerance", required_argument, NULL, OPTION_TOLERANCE },
+        { "max-megapixels", required_argument, NULL, OPTION_MAX_MEGAPIXELS },
+        { "threads", required_argument, NULL, OPTION_THREADS },
+        { "simd", required_argument, NULL, OPTION_SIMD },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case OPTION_OUTPUT:
+                options.output_filename = optarg;
+                break;
+            case OPTION_BASELINE:
+                options.baseline_filename = optarg;
+                break;
+            case OPTION_TOLERANCE:
+                options.tolerance = atof(optarg);
+                if (options.tolerance < 0) {
+                    fprintf(stderr, "Invalid tolerance '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_MAX_MEGAPIXELS:
+                options.max_megapixels = atof(optarg);
+                if (options.max_megapixels <= 0) {
+                    fprintf(stderr, "Invalid megapixels '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_THREADS:
+                options.threads = atoi(optarg);
+                if (options.threads < 1) {
+                    fprintf(stderr, "Invalid threads '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_SIMD:
+                if (simd_parse_level(optarg, &options.simd_level)) {
+                    fprintf(stderr, "Unknown SIMD level '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                show_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc != optind) {
+        show_usage(argv[0]);
+        return 1;
+    }
+
+    if (simd_select(options.simd_level)) {
+        fprintf(
+                stderr,
+                "SIMD level '%s' is not supported by this CPU\n",
+                simd_level_name(options.simd_level));
+        return 1;
+    }
+
+    int result = 0;
+
+    struct thread_pool *pool = NULL;
+    struct bench_results *results = NULL;
+    struct bench_results *baseline = NULL;
+
+    results = calloc(1, sizeof(struct bench_results));
+    if (!results) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        result = 1;
+        goto cleanup;
+    }
+
+    pool = thread_pool_create(options.threads);
+    if (!pool) {
+        result = 1;
+        goto cleanup;
+    }
+
+    results->threads = thread_pool_num_threads(pool);
+    snprintf(
+            results->simd,
+            sizeof(results->simd),
+            "%s",
+            simd_level_name(options.simd_level));
+
+    if (options.baseline_filename) {
+        baseline = malloc(sizeof(struct bench_results));
+        if (!baseline) {
+            fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+            result = 1;
+            goto cleanup;
+        }
+
+        if (read_bench_results(options.baseline_filename, baseline)) {
+            result = 1;
+            goto cleanup;
+        }
+
+        // The comparison is still made, since the baseline may simply come
+        // from a different machine, but it's worth knowing about.
+        if (baseline->threads != results->threads ||
+                strcmp(baseline->simd, results->simd) != 0) {
+            fprintf(
+                    stderr,
+                    "The baseline used %d threads and %s kernels\n",
+                    baseline->threads,
+                    baseline->simd);
+        }
+    }
+
+    printf(
+            "Using %d threads and %s kernels\n",
+            results->threads,
+            results->simd);
+
+    // The forward energy has no energy per pixel to check.
+    for (int i = 0; i < NUM_CARVER_ENERGIES; i++) {
+        if (i != CARVER_FORWARD_ENERGY && check_energy(i, pool)) {
+            fprintf(
+                    stderr,
+                    "The %s energy doesn't match its reference\n",
+                    carver_energy_name(i));
+
+            result = 1;
+            goto cleanup;
+        }
+    }
+
+    int num_regressions = 0;
+    for (int i = 0; i < NUM_BENCH_CASES; i++) {
+        const struct bench_case *bench_case = &bench_cases[i];
+        // The cases are named after their size rounded down, like 1mp for
+        // 1024x1024, so the limit leaves them some room.
+        double megapixels = (double) bench_case->w * bench_case->h / 1e6;
+        if (options.max_megapixels > 0 &&
+                megapixels > options.max_megapixels * BENCH_MEGAPIXELS_ROOM) {
+            continue;
+        }
+
+        printf(
+                "\n%s (%dx%d)\n",
+                bench_case->name,
+                bench_case->w,
+                bench_case->h);
+        printf(
+                "  %-12s %8s %10s %10s %10s%s\n",
+                "stage",
+                "samples",
+                "median ms",
+                "p95 ms",
+                "MP/s",
+                baseline ? "   baseline" : "");
+
+        int first_result = results->num_results;
+        if (run_bench_case(bench_case, pool, results)) {
+            result = 1;
+            goto cleanup;
+        }
+
+        num_regressions += report_bench_case(
+                results,
+                first_result,
+                baseline,
+                options.tolerance);
+    }
+
+    if (options.output_filename) {
+        printf("\nWriting results to '%s'\n", options.output_filename);
+        if (write_bench_results(results, options.output_filename)) {
+            result = 1;
+            goto cleanup;
+        }
+    }
+
+    if (num_regressions) {
+        fprintf(
+                stderr,
+                "%d stages are more than %.0f%% slower than the baseline\n",
+                num_regressions,
+                options.tolerance);
+        result = 1;
+    }
+
+cleanup:
+    thread_pool_free(pool);
+    if (results) { free(results); }
+    if (baseline) { free(baseline); }
+
+    return result;
+}
@@ -0,0 +1,268 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "seam-cache.h"
+
+#define SEAM_CACHE_EXTENSION ".scmap"
+
+// KEYS ///////////////////////////////////////////////////////////////////////
+
+// A simple multiply-xorshift hash, consuming 8 bytes at a time. It only needs
+// to be fast and well distributed, not cryptographically secure.
+
+static unsigned long long mix(unsigned long long hash) {
+    hash ^= hash >> 31;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+static unsigned long long hash_bytes(
+        const unsigned char *bytes,
+        size_t size,
+        unsigned long long hash) {
+    hash ^= size * 0x9e3779b97f4a7c15ULL;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        unsigned long long word;
+        memcpy(&word, bytes + i, 8);
+
+        hash = (hash ^ word) * 0xbf58476d1ce4e5b9ULL;
+        hash ^= hash >> 29;
+    }
+
+    unsigned long long tail = 0;
+    for (int shift = 0; i < size; i++, shift += 8) {
+        tail |= (unsigned long long) bytes[i] << shift;
+    }
+
+    return mix(hash ^ tail);
+}
+
+unsigned long long seam_cache_key(
+        const unsigned char *data,
+        int w,
+        int h,
+        const char *parameters) {
+    unsigned long long hash = mix(((unsigned long long) w << 32) | h);
+    hash = hash_bytes(data, (size_t) w * h * 3, hash);
+    hash = hash_bytes(
+            (const unsigned char *) parameters,
+            strlen(parameters),
+            hash);
+    return hash;
+}
+
+static void entry_filename(
+        char *filename,
+        size_t size,
+        const char *directory,
+        unsigned long long key) {
+    snprintf(filename, size, "%s/%016llx" SEAM_CACHE_EXTENSION, directory, key);
+}
+
+// LOOKUP /////////////////////////////////////////////////////////////////////
+
+int seam_cache_lookup(
+        const char *directory,
+        unsigned long long key,
+        struct seam_cache_entry *entry) {
+    char filename[1024];
+    entry_filename(filename, sizeof(filename), directory, key);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) { return 1; }
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) { return 1; }
+
+    // The whole map is validated, since the directory may be shared with
+    // other processes. A corrupted map is evicted and treated as a miss, so
+    // this run stores a valid one in its place. If another process replaced
+    // it in the meantime, that only costs it a miss.
+    if (parse_seam_order_map(mapping, st.st_size, &entry->map)) {
+        munmap(mapping, st.st_size);
+        unlink(filename);
+        return 1;
+    }
+
+    entry->mapping = mapping;
+    entry->mapping_size = st.st_size;
+
+    // Mark the map as recently used. It doesn't matter if this fails, for
+    // example because another process just evicted the map.
+    utimes(filename, NULL);
+
+    return 0;
+}
+
+void seam_cache_release(struct seam_cache_entry *entry) {
+    if (entry->mapping) {
+        munmap(entry->mapping, entry->mapping_size);
+        entry->mapping = NULL;
+    }
+}
+
+// EVICTION ///////////////////////////////////////////////////////////////////
+
+struct cached_file {
+    char name[256];
+    unsigned long long size;
+    struct timespec modified;
+};
+
+static int compare_least_recently_used(const void *a, const void *b) {
+    const struct cached_file *file_a = a;
+    const struct cached_file *file_b = b;
+
+    if (file_a->modified.tv_sec != file_b->modified.tv_sec) {
+        return file_a->modified.tv_sec < file_b->modified.tv_sec ? -1 : 1;
+    }
+
+    if (file_a->modified.tv_nsec != file_b->modified.tv_nsec) {
+        return file_a->modified.tv_nsec < file_b->modified.tv_nsec ? -1 : 1;
+    }
+
+    return strcmp(file_a->name, file_b->name);
+}
+
+static void evict(
+        const char *directory,
+        const char *kept_name,
+        unsigned long long max_size) {
+    struct cached_file *files = NULL;
+    int num_files = 0;
+    int capacity = 0;
+    unsigned long long total_size = 0;
+
+    DIR *dir = opendir(directory);
+    if (!dir) { return; }
+
+    struct dirent *dirent;
+    while ((dirent = readdir(dir))) {
+        size_t length = strlen(dirent->d_name);
+        size_t extension_length = strlen(SEAM_CACHE_EXTENSION);
+        if (dirent->d_name[0] == '.' ||
+                length <= extension_length ||
+                length >= sizeof(files->name) ||
+                strcmp(
+                    dirent->d_name + length - extension_length,
+                    SEAM_CACHE_EXTENSION) != 0) {
+            continue;
+        }
+
+        char filename[1024];
+        snprintf(
+                filename,
+                sizeof(filename),
+                "%s/%s",
+                directory,
+                dirent->d_name);
+
+        struct stat st;
+        if (stat(filename, &st)) { continue; }
+
+        if (num_files == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct cached_file *grown =
+                realloc(files, capacity * sizeof(struct cached_file));
+            if (!grown) {
+                fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+                goto cleanup;
+            }
+            files = grown;
+        }
+
+        struct cached_file *file = &files[num_files++];
+        strcpy(file->name, dirent->d_name);
+        file->size = st.st_size;
+        file->modified = st.st_mtim;
+        total_size += st.st_size;
+    }
+
+    if (total_size <= max_size) { goto cleanup; }
+
+    qsort(files, num_files, sizeof(struct cached_file),
+            compare_least_recently_used);
+
+    for (int i = 0; i < num_files && total_size > max_size; i++) {
+        if (strcmp(files[i].name, kept_name) == 0) { continue; }
+
+        char filename[1024];
+        snprintf(filename, sizeof(filename), "%s/%s", directory, files[i].name);
+
+        // Another process may have evicted the same map already. Either way,
+        // the map is no longer taking up space.
+        printf("Evicting '%s' from the cache\n", filename);
+        unlink(filename);
+        total_size -= files[i].size;
+    }
+
+cleanup:
+    closedir(dir);
+    if (files) { free(files); }
+}
+
+// STORE //////////////////////////////////////////////////////////////////////
+
+int seam_cache_store(
+        const char *directory,
+        unsigned long long key,
+        const unsigned int *removal_order,
+        int w,
+        int h,
+        int num_seams,
+        unsigned long long max_size) {
+    char filename[1024];
+    entry_filename(filename, sizeof(filename), directory, key);
+
+    // The temporary file is in the same directory, so the rename is atomic.
+    // Including the process ID keeps concurrent writers of the same map from
+    // clobbering each other's temporary files.
+    char temporary_filename[1024];
+    snprintf(
+            temporary_filename,
+            sizeof(temporary_filename),
+            "%s/.%016llx.%ld.tmp",
+            directory,
+            key,
+            (long) getpid());
+
+    if (write_seam_order_map(
+                temporary_filename,
+                removal_order,
+                w,
+                h,
+                num_seams)) {
+        unlink(temporary_filename);
+        return 1;
+    }
+
+    if (rename(temporary_filename, filename)) {
+        fprintf(stderr, "Unable to write '%s'\n", filename);
+
+        unlink(temporary_filename);
+        return 1;
+    }
+
+    evict(directory, strrchr(filename, '/') + 1, max_size);
+
+    return 0;
+}
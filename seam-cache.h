@@ -0,0 +1,56 @@
+#ifndef SEAM_CACHE_H
+#define SEAM_CACHE_H
+
+#include <stddef.h>
+
+#include "seam-order.h"
+
+// A directory of seam order maps, keyed by a hash of the decoded pixels and
+// of every parameter that affects which seams are removed. Maps are written
+// to a temporary file and renamed into place, so concurrent processes sharing
+// the same directory never see a partially written map. Maps are read through
+// a read-only memory mapping.
+//
+// The directory is kept under a maximum total size by evicting the least
+// recently used maps, based on their modification times, which are updated on
+// every cache hit.
+
+struct seam_cache_entry {
+    struct seam_order_map map;
+
+    void *mapping;
+    size_t mapping_size;
+};
+
+// Hashes the pixels of an image along with a string describing the
+// parameters used to carve it.
+unsigned long long seam_cache_key(
+        const unsigned char *data,
+        int w,
+        int h,
+        const char *parameters);
+
+// Looks up and maps the seam order map for the given key. Returns non-zero if
+// there is no valid map for that key, evicting the map if it is corrupted. On
+// success, the entry must be released with `seam_cache_release`.
+int seam_cache_lookup(
+        const char *directory,
+        unsigned long long key,
+        struct seam_cache_entry *entry);
+
+void seam_cache_release(struct seam_cache_entry *entry);
+
+// Stores a seam order map, in the same format as `write_seam_order_map`,
+// replacing any existing map for the same key. Then evicts the least recently
+// used maps until the directory is under `max_size` bytes. Returns non-zero on
+// error.
+int seam_cache_store(
+        const char *directory,
+        unsigned long long key,
+        const unsigned int *removal_order,
+        int w,
+        int h,
+        int num_seams,
+        unsigned long long max_size);
+
+#endif
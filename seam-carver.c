@@ -1,360 +1,1084 @@
+#include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
+
+// The failure reason is a global shared by every thread, and a batch loads
+// images on many threads at once, so it's left out entirely. That leaves the
+// function setting it unused.
+#define STBI_NO_FAILURE_STRINGS
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
 #include "stb_image.h"
+#pragma GCC diagnostic pop
+
 #include "stb_image_write.h"
 
-// ENERGY /////////////////////////////////////////////////////////////////////
+#include "carver.h"
+#include "frame-writer.h"
+#include "seam-cache.h"
+#include "seam-log.h"
+#include "seam-order.h"
+#include "simd.h"
+#include "thread-pool.h"
+#include "trace.h"
 
-unsigned int energy_at(
-        const unsigned char *data,
+// OUTPUT /////////////////////////////////////////////////////////////////////
+
+int write_energy(
+        const unsigned int *energy,
         int w,
         int h,
-        int x,
-        int y) {
-    int x0 = x == 0 ? x : x - 1;
-    int x1 = x == w - 1 ? x : x + 1;
-    int ix0 = (y * w + x0) * 3;
-    int ix1 = (y * w + x1) * 3;
-    unsigned int dxr = data[ix0    ] - data[ix1    ];
-    unsigned int dxg = data[ix0 + 1] - data[ix1 + 1];
-    unsigned int dxb = data[ix0 + 2] - data[ix1 + 2];
-    unsigned int dx = dxr * dxr + dxg * dxg + dxb * dxb;
-
-    int y0 = y == 0 ? y : y - 1;
-    int y1 = y == h - 1 ? y : y + 1;
-    int iy0 = (y0 * w + x) * 3;
-    int iy1 = (y1 * w + x) * 3;
-    unsigned int dyr = data[iy0    ] - data[iy1    ];
-    unsigned int dyg = data[iy0 + 1] - data[iy1 + 1];
-    unsigned int dyb = data[iy0 + 2] - data[iy1 + 2];
-    unsigned int dy = dyr * dyr + dyg * dyg + dyb * dyb;
-
-    return dx + dy;
-}
+        int stride,
+        const char *filename) {
+    int result = 0;
 
-unsigned int * compute_energy(const unsigned char *data, int w, int h) {
-    unsigned int *energy = malloc(w * h * sizeof(unsigned int));
-    if (!energy) {
+    unsigned char *energy_normalized = malloc(w * h);
+    if (!energy_normalized) {
         fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
-        return NULL;
+
+        result = 1;
+        goto cleanup;
     }
 
+    int max_energy = 1;
     for (int y = 0; y < h; y++)
     for (int x = 0; x < w; x++) {
-        int i = y * w + x;
-        energy[i] = energy_at(data, w, h, x, y);
+        int i = y * stride + x;
+        max_energy = energy[i] > max_energy ? energy[i] : max_energy;
     }
 
-    return energy;
+    for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++) {
+        int i = y * stride + x;
+        energy_normalized[y * w + x] =
+            (char) ((double) energy[i] / max_energy * 255);
+    }
+
+    printf("Writing to '%s'\n", filename);
+    if (!stbi_write_jpg(filename, w, h, 1, energy_normalized, 80)) {
+        fprintf(stderr, "Unable to write output (%d)\n", __LINE__);
+
+        result = 1;
+        goto cleanup;
+    }
+
+cleanup:
+    if (energy_normalized) { free(energy_normalized); }
+
+    return result;
 }
 
-// SEAMS //////////////////////////////////////////////////////////////////////
+int draw_image(const struct image_view *img, const char *filename) {
+    // The JPEG writer expects the rows to be contiguous.
+    if (img->stride != img->w) {
+        fprintf(stderr, "Unable to write a strided image (%d)\n", __LINE__);
+        return 0;
+    }
+
+    printf("Writing %dx%d image to '%s'\n", img->w, img->h, filename);
+    return stbi_write_jpg(filename, img->w, img->h, 3, img->data, 80);
+}
 
-struct seam_link {
-    // The X and Y coordinates of the link are inferred by the position of the
-    // link in a links array.
+// MAIN ///////////////////////////////////////////////////////////////////////
 
-    // The minimal energy for any connected seam ending at this position.
-    unsigned int energy;
+void show_usage(const char *program) {
+    fprintf(
+            stderr,
+            "USAGE:\n"
+            "  %s [options] <input-filename> <output-directory> "
+            "<num-iterations>\n"
+            "  %s [options] --batch=<manifest>\n"
+            "\n"
+            "OPTIONS:\n"
+            "  -i, --incremental  keep the energy and seam links across\n"
+            "                     iterations, only recomputing the parts\n"
+            "                     affected by each removed seam\n"
+            "  -k, --seams-per-pass=<k>\n"
+            "                     remove up to k non-crossing seams found\n"
+            "                     from the same seam links on each\n"
+            "                     iteration, trading quality for speed\n"
+            "                     (default: 1)\n"
+            "  --pyramid=<levels> find each seam on an image downsampled\n"
+            "                     up to <levels> times, then refine it on\n"
+            "                     each finer level, trading quality for\n"
+            "                     speed on large images (default: 0)\n"
+            "  --corridor=<r>     how many pixels around the seam of the\n"
+            "                     coarser level each refined seam can move\n"
+            "                     by, with --pyramid (default: 16)\n"
+            "  --energy=<name>    how the cost of removing each pixel is\n"
+            "                     measured: gradient, l1, luma, sobel,\n"
+            "                     scharr, entropy, hog or forward\n"
+            "                     (default: gradient)\n"
+            "  --horizontal-seams=<n>\n"
+            "                     after the vertical seams, also remove n\n"
+            "                     horizontal seams, one at a time\n"
+            "                     (default: 0)\n"
+            "  --order=<order>    order in which to remove the vertical and\n"
+            "                     horizontal seams: sequential, greedy or\n"
+            "                     optimal (default: sequential)\n"
+            "  --compare-exact    also remove the seams one at a time from\n"
+            "                     a copy of the image, and report the\n"
+            "                     difference in total seam energy\n"
+            "  --write-map=<file> write the order in which the pixels were\n"
+            "                     removed to a seam order map\n"
+            "  --from-map=<file>  remove the seams using a seam order map\n"
+            "                     written by a previous run, without\n"
+            "                     computing any energy or seams\n"
+            "  --cache-dir=<dir>  look up the seam order map of the input in\n"
+            "                     a cache directory, skipping the carving if\n"
+            "                     found, and store it there otherwise\n"
+            "  --cache-size=<mb>  maximum total size of the cache directory,\n"
+            "                     in megabytes (default: 1024)\n"
+            "  --threads=<n>      number of threads computing the energy and\n"
+            "                     finding the vertical seams (default: the\n"
+            "                     number of CPUs)\n"
+            "  --writer-threads=<n>\n"
+            "                     number of background threads encoding the\n"
+            "                     seam images, or 0 to encode them on the\n"
+            "                     main thread (default: 2)\n"
+            "  --y4m=<file>       write the seam images as a YUV4MPEG2 video\n"
+            "                     to <file>, or to standard output if <file>\n"
+            "                     is -, instead of as individual JPEGs\n"
+            "  --seam-log=<file>  record the seams in a compact seam log,\n"
+            "                     instead of writing any seam images\n"
+            "  --batch=<manifest> resize every image listed in a manifest,\n"
+            "                     one '<input> <output> <w>x<h>' per line,\n"
+            "                     only writing the resized images\n"
+            "  --simd=<level>     vector instruction set to use: scalar,\n"
+            "                     sse4.1, avx2 or avx512 (default: the\n"
+            "                     widest one supported by the CPU)\n"
+            "  --trace=<file>     time every stage of every iteration, write\n"
+            "                     the timings to <file> as a Chrome trace,\n"
+            "                     and print a summary per stage\n",
+            program,
+            program);
+}
 
-    // The parent X coordinate for vertical seams, Y for horizontal seams.
-    int parent_coordinate;
+enum seam_ordering {
+    SEQUENTIAL_ORDER,
+    GREEDY_ORDER,
+    OPTIMAL_ORDER
 };
 
-struct seam_link * compute_vertical_seam_links(
-        const unsigned int *energy,
-        int w,
-        int h) {
-    struct seam_link *links = malloc(w * h * sizeof(struct seam_link));
-    if (!links) {
-        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
-        return NULL;
-    }
+struct options {
+    enum carver_energy energy;
+    int incremental;
+    int seams_per_pass;
+    int pyramid_levels;
+    int corridor_radius;
+    int horizontal_seams;
+    enum seam_ordering ordering;
+    int compare_exact;
+    const char *write_map_filename;
+    const char *from_map_filename;
+    const char *cache_directory;
+    unsigned long long cache_size;
+    int threads;
+    int writer_threads;
+    const char *y4m_filename;
+    const char *seam_log_filename;
+    const char *batch_filename;
+    enum simd_level simd_level;
+    const char *trace_filename;
+};
 
-    for (int x = 0; x < w; x++) {
-        links[x] = (struct seam_link) {
-            .energy = energy[x],
-            .parent_coordinate = -1
-        };
-    }
+enum {
+    OPTION_SIMD = 256,
+    OPTION_COMPARE_EXACT,
+    OPTION_WRITE_MAP,
+    OPTION_FROM_MAP,
+    OPTION_CACHE_DIR,
+    OPTION_CACHE_SIZE,
+    OPTION_WRITER_THREADS,
+    OPTION_Y4M,
+    OPTION_SEAM_LOG,
+    OPTION_HORIZONTAL_SEAMS,
+    OPTION_ORDER,
+    OPTION_THREADS,
+    OPTION_BATCH,
+    OPTION_TRACE,
+    OPTION_ENERGY,
+    OPTION_PYRAMID,
+    OPTION_CORRIDOR
+};
 
-    for (int y = 1; y < h; y++)
-    for (int x = 0; x < w; x++) {
-        int i = y * w + x;
-
-        int min_parent_energy = INT_MAX;
-        int min_parent_x = -1;
-
-        int parent_x = x == 0 ? x : x - 1;
-        int parent_x_end = x == w - 1 ? x : x + 1;
-        for (; parent_x <= parent_x_end; parent_x++) {
-            int candidate_energy = links[(y - 1) * w + parent_x].energy;
-            if (candidate_energy < min_parent_energy) {
-                min_parent_energy = candidate_energy;
-                min_parent_x = parent_x;
-            }
-        }
+struct visualization {
+    const char *output_directory;
 
-        links[i] = (struct seam_link) {
-            .energy = energy[i] + min_parent_energy,
-            .parent_coordinate = min_parent_x
-        };
-    }
+    // The energy of the original image is computed on the first iteration.
+    struct carver *carver;
 
-    return links;
-}
+    // Encodes the seam frames, either in the background or synchronously,
+    // depending on its number of threads. The frames are appended to its
+    // video stream if it has one, instead of being written as individual
+    // JPEGs.
+    struct frame_writer *frame_writer;
 
-int * get_minimal_seam(
-        const struct seam_link *seam_links,
-        int num_seams,
-        int seam_length) {
-    int *minimal_seam = malloc(seam_length * sizeof(int));
-    if (!minimal_seam) {
-        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+    // When set, only the seams are recorded, and no frames are encoded.
+    struct seam_log_writer *seam_log;
+};
 
-        goto cleanup;
+int write_seams_frame(
+        const struct visualization *visualization,
+        const struct image_view *img,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams,
+        int iteration) {
+    if (visualization->seam_log) {
+        return seam_log_append(
+                visualization->seam_log,
+                direction,
+                seams,
+                num_seams);
     }
 
-    int min_coordinate = -1;
-    int min_energy = INT_MAX;
+    return frame_writer_write_iteration(
+            visualization->frame_writer,
+            img->data,
+            img->w,
+            img->h,
+            img->stride,
+            direction,
+            seams,
+            num_seams,
+            visualization->output_directory,
+            iteration);
+}
 
-    for (int coordinate = 0; coordinate < num_seams; coordinate++) {
-        int i = num_seams * (seam_length - 1) + coordinate;
-        if (seam_links[i].energy < min_energy) {
-            min_coordinate = coordinate;
-            min_energy = seam_links[i].energy;
+int visualize_iteration(
+        void *context,
+        const struct carver_iteration *iteration) {
+    // Writes the energy of the original image, if there is one, then the
+    // seams of every iteration.
+    const struct visualization *visualization = context;
+    const struct image_view *img = iteration->img;
+
+    const unsigned int *energy = iteration->iteration == 0 ?
+        carver_compute_energy(visualization->carver) :
+        NULL;
+    if (energy) {
+        char output_filename[1024];
+        snprintf(
+                output_filename,
+                1024,
+                "%s/img-energy.jpg",
+                visualization->output_directory);
+        if (write_energy(
+                    energy,
+                    img->w,
+                    img->h,
+                    img->stride,
+                    output_filename)) {
+            return 1;
         }
     }
 
-    int i = 0;
-    int offset = min_coordinate;
+    return write_seams_frame(
+            visualization,
+            img,
+            iteration->direction,
+            iteration->seams,
+            iteration->num_seams,
+            iteration->iteration);
+}
 
-    for (int d = 0; d < seam_length; d++) {
-        minimal_seam[i++] = offset;
+unsigned char * load_image_traced(
+        struct trace *trace,
+        const char *filename,
+        int *w,
+        int *h) {
+    unsigned long long start = trace_begin(trace);
+
+    int n;
+    unsigned char *data = stbi_load(filename, w, h, &n, 3);
+    if (data) {
+        trace_end(
+                trace,
+                TRACE_DECODE,
+                -1,
+                start,
+                (long long) *w * *h,
+                (long long) *w * *h * 3);
+    }
 
-        struct seam_link end =
-            seam_links[num_seams * (seam_length - 1 - d) + offset];
+    return data;
+}
 
-        offset = end.parent_coordinate;
-    }
+int draw_image_traced(
+        struct trace *trace,
+        const struct image_view *img,
+        const char *filename) {
+    unsigned long long start = trace_begin(trace);
+    int result = draw_image(img, filename);
+    trace_end(
+            trace,
+            TRACE_ENCODE,
+            -1,
+            start,
+            (long long) img->w * img->h,
+            0);
 
-cleanup:
-    return minimal_seam;
+    return result;
 }
 
-// REMOVAL ////////////////////////////////////////////////////////////////////
+int finish_trace(struct trace *trace, const char *filename) {
+    // Prints the summary, then writes the Chrome trace. Returns non-zero on
+    // error.
+    if (!trace) { return 0; }
 
-unsigned char * image_after_vertical_seam_removal(
-        const unsigned char *original_data,
-        const int *vertical_seam,
-        int w,
-        int h) {
-    unsigned char *img = malloc((w - 1) * h * 3);
-    if (!img) {
+    trace_print_summary(trace, stdout);
+
+    printf("Writing trace to '%s'\n", filename);
+    return trace_write_chrome(trace, filename);
+}
+
+double elapsed_seconds(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int remove_seams_in_best_order(
+        struct carver *carver,
+        enum seam_ordering ordering,
+        int num_vertical_seams,
+        int num_horizontal_seams) {
+    // Finds the order in which to remove the seams with either the greedy or
+    // the optimal strategy, reports how long that took, then removes the
+    // seams in that order.
+    int result = 0;
+
+    int num_seams = num_vertical_seams + num_horizontal_seams;
+    enum seam_direction *order =
+        malloc((num_seams > 0 ? num_seams : 1) * sizeof(enum seam_direction));
+    if (!order) {
         fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
-        return NULL;
+
+        result = 1;
+        goto cleanup;
     }
 
-    for (int y = 0; y < h; y++) {
-        int seamx = vertical_seam[h - 1 - y];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    unsigned long long total_energy;
+    int (*find_seam_order)(
+            struct carver *,
+            int,
+            int,
+            enum seam_direction *,
+            unsigned long long *) =
+        ordering == GREEDY_ORDER ?
+            carver_find_greedy_seam_order :
+            carver_find_optimal_seam_order;
+    if (find_seam_order(
+                carver,
+                num_vertical_seams,
+                num_horizontal_seams,
+                order,
+                &total_energy)) {
+        result = 1;
+        goto cleanup;
+    }
 
-        for (int x = 0, imgx = 0; imgx < w - 1; x++, imgx++) {
-            if (x == seamx) { x++; }
+    printf(
+            "Found the %s seam order in %.3f seconds, with a total seam "
+            "energy of %llu\n",
+            ordering == GREEDY_ORDER ? "greedy" : "optimal",
+            elapsed_seconds(&start),
+            total_energy);
 
-            int    i = (y *  w      + x   ) * 3;
-            int imgi = (y * (w - 1) + imgx) * 3;
+    result = carver_remove_seams_in_order(carver, order, num_seams);
 
-            img[imgi    ] = original_data[i    ];
-            img[imgi + 1] = original_data[i + 1];
-            img[imgi + 2] = original_data[i + 2];
-        }
-    }
+cleanup:
+    if (order) { free(order); }
 
-    return img;
+    return result;
 }
 
-// OUTPUT /////////////////////////////////////////////////////////////////////
-
-int write_energy(
-        const unsigned int *energy,
+int resize_with_seam_order_map(
+        const struct seam_order_map *map,
+        const unsigned char *data,
         int w,
         int h,
-        const char *filename) {
+        int num_seams,
+        const char *output_filename) {
     int result = 0;
 
-    unsigned char *energy_normalized = malloc(w * h);
-    if (!energy_normalized) {
-        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+    unsigned char *output_data = NULL;
+
+    if (map->w != w || map->h != h) {
+        fprintf(
+                stderr,
+                "Seam order map is for a %dx%d image\n",
+                map->w,
+                map->h);
 
         result = 1;
         goto cleanup;
     }
 
-    int max_energy = 1;
-    for (int y = 0; y < h; y++)
-    for (int x = 0; x < w; x++) {
-        int i = y * w + x;
-        max_energy = energy[i] > max_energy ? energy[i] : max_energy;
-    }
+    if (num_seams > map->num_seams) {
+        fprintf(
+                stderr,
+                "Seam order map only contains %d seams\n",
+                map->num_seams);
 
-    for (int y = 0; y < h; y++)
-    for (int x = 0; x < w; x++) {
-        int i = y * w + x;
-        energy_normalized[i] = (char) ((double) energy[i] / max_energy * 255);
+        result = 1;
+        goto cleanup;
     }
 
-    printf("Writing to '%s'\n", filename);
-    if (!stbi_write_jpg(filename, w, h, 1, energy_normalized, 80)) {
-        fprintf(stderr, "Unable to write output (%d)\n", __LINE__);
+    output_data = malloc((w - num_seams) * h * 3);
+    if (!output_data) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
 
         result = 1;
         goto cleanup;
     }
 
+    apply_seam_order_map(map, data, num_seams, output_data);
+
+    struct image_view output_img = {
+        .data = output_data,
+        .w = w - num_seams,
+        .h = h,
+        .stride = w - num_seams
+    };
+    if (!draw_image(&output_img, output_filename)) {
+        fprintf(
+                stderr,
+                "\033[1;31mUnable to write %s\033[0m\n",
+                output_filename);
+    }
+
 cleanup:
-    if (energy_normalized) { free(energy_normalized); }
+    if (output_data) { free(output_data); }
 
     return result;
 }
 
-int draw_vertical_seam(
-        const unsigned char *data,
-        const int *minimal_vertical_seam,
-        int w,
-        int h,
-        const char *filename) {
+void cache_parameters(
+        const struct options *options,
+        char *parameters,
+        size_t size) {
+    // Every option that changes which seams are removed must be included, so
+    // maps carved with different options don't share a cache entry.
+    snprintf(
+            parameters,
+            size,
+            "energy=%s;seams-per-pass=%d",
+            carver_energy_name(options->energy),
+            options->seams_per_pass);
+
+    // Left out without a pyramid, keeping the existing cache entries.
+    if (options->pyramid_levels > 0) {
+        size_t length = strlen(parameters);
+        snprintf(
+                parameters + length,
+                size - length,
+                ";pyramid=%d;corridor=%d",
+                options->pyramid_levels,
+                options->corridor_radius);
+    }
+}
+
+// A batch resizes many images in one run, as listed in a manifest with one
+// image per line:
+//
+//   <input-filename> <output-filename> <width>x<height>
+//
+// Blank lines and lines starting with # are ignored. Every image is resized
+// in its own task on the thread pool, and its energy and seam computations
+// are split into nested tasks on the same pool. With many small images, the
+// threads each pick up whole images, while the last few images, or a single
+// large one, get split across the threads that run out of images.
+
+struct batch_entry {
+    char input_filename[1024];
+    char output_filename[1024];
+    int target_w;
+    int target_h;
+
+    // Read from the image header up front, so the largest images are started
+    // first, then from the image itself.
+    int w;
+    int h;
+
+    int failed;
+};
+
+struct batch {
+    const struct options *options;
+    struct thread_pool *pool;
+    struct trace *trace;
+    struct batch_entry *entries;
+    int num_entries;
+};
+
+int read_batch_manifest(const char *filename, struct batch *batch) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Unable to read '%s'\n", filename);
+        return 1;
+    }
+
     int result = 0;
+    int capacity = 0;
+    char line[4096];
+
+    for (int line_number = 1; fgets(line, sizeof(line), file); line_number++) {
+        char *start = line + strspn(line, " \t\r\n");
+        if (*start == '\0' || *start == '#') { continue; }
+
+        if (batch->num_entries == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct batch_entry *entries = realloc(
+                    batch->entries,
+                    capacity * sizeof(struct batch_entry));
+            if (!entries) {
+                fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+                result = 1;
+                goto cleanup;
+            }
 
-    unsigned char *data_with_seams = malloc(w * h * 3);
-    if (!data_with_seams) {
-        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+            batch->entries = entries;
+        }
+
+        struct batch_entry *entry = &batch->entries[batch->num_entries];
+        memset(entry, 0, sizeof(struct batch_entry));
+
+        char extra;
+        if (sscanf(
+                    start,
+                    "%1023s %1023s %dx%d %c",
+                    entry->input_filename,
+                    entry->output_filename,
+                    &entry->target_w,
+                    &entry->target_h,
+                    &extra) != 4 ||
+                entry->target_w < 1 ||
+                entry->target_h < 1) {
+            fprintf(
+                    stderr,
+                    "Invalid entry on line %d of '%s'\n",
+                    line_number,
+                    filename);
+
+            result = 1;
+            goto cleanup;
+        }
+
+        int n;
+        stbi_info(entry->input_filename, &entry->w, &entry->h, &n);
+        batch->num_entries++;
+    }
+
+cleanup:
+    fclose(file);
+
+    return result;
+}
+
+int compare_batch_entry_sizes(const void *a, const void *b) {
+    const struct batch_entry *entry_a = a;
+    const struct batch_entry *entry_b = b;
+    long long pixels_a = (long long) entry_a->w * entry_a->h;
+    long long pixels_b = (long long) entry_b->w * entry_b->h;
+
+    return (pixels_a < pixels_b) - (pixels_a > pixels_b);
+}
+
+int resize_batch_image(
+        const struct batch *batch,
+        struct batch_entry *entry) {
+    int result = 0;
+
+    unsigned char *data = NULL;
+    struct carver *carver = NULL;
+
+    data = load_image_traced(
+            batch->trace,
+            entry->input_filename,
+            &entry->w,
+            &entry->h);
+    if (!data) {
+        fprintf(stderr, "Unable to read '%s'\n", entry->input_filename);
 
         result = 1;
         goto cleanup;
     }
 
-    memcpy(data_with_seams, data, w * h * 3);
+    if (entry->target_w > entry->w || entry->target_h > entry->h) {
+        fprintf(
+                stderr,
+                "Unable to resize '%s' from %dx%d to %dx%d\n",
+                entry->input_filename,
+                entry->w,
+                entry->h,
+                entry->target_w,
+                entry->target_h);
 
-    for (int y = h - 1; y >= 0; y--) {
-        int x = minimal_vertical_seam[h - 1 - y];
-        int i = (y * w + x) * 3;
+        result = 1;
+        goto cleanup;
+    }
 
-        data_with_seams[i    ] = 255;
-        data_with_seams[i + 1] = 0;
-        data_with_seams[i + 2] = 0;
+    carver = carver_create(
+            data,
+            entry->w,
+            entry->h,
+            batch->options->energy,
+            batch->options->incremental,
+            batch->options->seams_per_pass,
+            batch->options->pyramid_levels,
+            batch->options->corridor_radius,
+            0,
+            batch->pool,
+            batch->trace);
+    if (!carver ||
+            carver_remove_vertical_seams(
+                carver,
+                entry->w - entry->target_w) ||
+            carver_remove_horizontal_seams(
+                carver,
+                entry->h - entry->target_h)) {
+        result = 1;
+        goto cleanup;
     }
 
-    printf("Writing to '%s'\n", filename);
-    if (!stbi_write_jpg(filename, w, h, 3, data_with_seams, 80)) {
-        fprintf(stderr, "Unable to write output (%d)\n", __LINE__);
+    carver_compact_image(carver);
+
+    if (!draw_image_traced(
+                batch->trace,
+                carver_image(carver),
+                entry->output_filename)) {
+        fprintf(
+                stderr,
+                "\033[1;31mUnable to write %s\033[0m\n",
+                entry->output_filename);
 
         result = 1;
         goto cleanup;
     }
 
 cleanup:
-    if (data_with_seams) { free(data_with_seams); }
+    carver_free(carver);
+    if (data) { stbi_image_free(data); }
 
     return result;
 }
 
-int draw_image(
-        const unsigned char *data,
-        int w,
-        int h,
-        const char *filename) {
-    printf("Writing %dx%d image to '%s'\n", w, h, filename);
-    return stbi_write_jpg(filename, w, h, 3, data, 80);
+void resize_batch_entry(void *context, int index) {
+    const struct batch *batch = context;
+    struct batch_entry *entry = &batch->entries[index];
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    entry->failed = resize_batch_image(batch, entry);
+    if (entry->failed) { return; }
+
+    double seconds = elapsed_seconds(&start);
+    double megapixels = (double) entry->w * entry->h / 1e6;
+    printf(
+            "Resized '%s' from %dx%d to %dx%d in %.3f seconds "
+            "(%.2f MP/s)\n",
+            entry->input_filename,
+            entry->w,
+            entry->h,
+            entry->target_w,
+            entry->target_h,
+            seconds,
+            seconds > 0 ? megapixels / seconds : 0.0);
 }
 
-// MAIN ///////////////////////////////////////////////////////////////////////
+int run_batch(const struct options *options) {
+    int result = 0;
 
-void show_usage(const char *program) {
-    fprintf(
-            stderr,
-            "USAGE:\n"
-            "  %s <input-filename> <output-directory> <num-iterations>\n",
-            program);
-}
+    struct batch batch = {
+        .options = options,
+        .pool = NULL,
+        .trace = NULL,
+        .entries = NULL,
+        .num_entries = 0
+    };
 
-unsigned char * run_iteration(
-        const char *output_directory,
-        const unsigned char *data,
-        int w,
-        int h,
-        int iteration) {
+    printf("Reading '%s'\n", options->batch_filename);
 
-    unsigned int *energy = NULL;
-    struct seam_link *vertical_seam_links = NULL;
-    int *minimal_vertical_seam = NULL;
-    unsigned char *output_data = NULL;
+    if (read_batch_manifest(options->batch_filename, &batch)) {
+        result = 1;
+        goto cleanup;
+    }
 
-    char output_filename[1024];
+    printf("Using %s kernels\n", simd_level_name(options->simd_level));
 
-    energy = compute_energy(data, w, h);
-    if (!energy) { goto cleanup; }
+    batch.pool = thread_pool_create(options->threads);
+    if (!batch.pool) {
+        result = 1;
+        goto cleanup;
+    }
 
-    if (iteration == 0) {
-        snprintf(output_filename, 1024, "%s/img-energy.jpg", output_directory);
-        if (write_energy(energy, w, h, output_filename)) {
-            goto cleanup;
-        }
+    if (options->trace_filename && !(batch.trace = trace_create())) {
+        result = 1;
+        goto cleanup;
     }
 
-    vertical_seam_links = compute_vertical_seam_links(energy, w, h);
-    if (!vertical_seam_links) { goto cleanup; }
+    printf(
+            "Resizing %d images using %d threads\n",
+            batch.num_entries,
+            thread_pool_num_threads(batch.pool));
+
+    // The largest images go first, so they don't hold up the end of the
+    // batch, and the smallest ones fill in the gaps.
+    qsort(
+            batch.entries,
+            batch.num_entries,
+            sizeof(struct batch_entry),
+            compare_batch_entry_sizes);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    thread_pool_parallel_for(
+            batch.pool,
+            batch.num_entries,
+            resize_batch_entry,
+            &batch);
+
+    double seconds = elapsed_seconds(&start);
+    double megapixels = 0;
+    int num_failed = 0;
+    for (int i = 0; i < batch.num_entries; i++) {
+        if (batch.entries[i].failed) {
+            num_failed++;
+        } else {
+            megapixels +=
+                (double) batch.entries[i].w * batch.entries[i].h / 1e6;
+        }
+    }
 
-    minimal_vertical_seam = get_minimal_seam(vertical_seam_links, w, h);
+    printf(
+            "Resized %d images, %.2f MP in total, in %.3f seconds "
+            "(%.2f MP/s)\n",
+            batch.num_entries - num_failed,
+            megapixels,
+            seconds,
+            seconds > 0 ? megapixels / seconds : 0.0);
 
-    snprintf(
-            output_filename,
-            1024,
-            "%s/img-seam-%04d.jpg",
-            output_directory,
-            iteration);
-    if (draw_vertical_seam(
-                data,
-                minimal_vertical_seam,
-                w,
-                h,
-                output_filename)) {
-        goto cleanup;
+    if (num_failed) {
+        fprintf(stderr, "Unable to resize %d images\n", num_failed);
+        result = 1;
     }
 
-    output_data =
-        image_after_vertical_seam_removal(data, minimal_vertical_seam, w, h);
+    if (finish_trace(batch.trace, options->trace_filename)) { result = 1; }
 
 cleanup:
-    if (energy) { free(energy); }
-    if (vertical_seam_links) { free(vertical_seam_links); }
-    if (minimal_vertical_seam) { free(minimal_vertical_seam); }
+    thread_pool_free(batch.pool);
+    trace_free(batch.trace);
+    if (batch.entries) { free(batch.entries); }
 
-    return output_data;
+    return result;
 }
 
 int main(int argc, char **argv) {
-    if (argc != 4) {
+    struct options options = {
+        .energy = CARVER_GRADIENT_ENERGY,
+        .incremental = 0,
+        .seams_per_pass = 1,
+        .pyramid_levels = 0,
+        .corridor_radius = 16,
+        .horizontal_seams = 0,
+        .ordering = SEQUENTIAL_ORDER,
+        .compare_exact = 0,
+        .write_map_filename = NULL,
+        .from_map_filename = NULL,
+        .cache_directory = NULL,
+        .cache_size = 1024ULL * 1024 * 1024,
+        .threads = sysconf(_SC_NPROCESSORS_ONLN),
+        .writer_threads = 2,
+        .y4m_filename = NULL,
+        .seam_log_filename = NULL,
+        .batch_filename = NULL,
+        .simd_level = simd_detect(),
+        .trace_filename = NULL
+    };
+
+    static const struct option long_options[] = {
+        { "incremental", no_argument, NULL, 'i' },
+        { "seams-per-pass", required_argument, NULL, 'k' },
+        { "pyramid", required_argument, NULL, OPTION_PYRAMID },
+        { "corridor", required_argument, NULL, OPTION_CORRIDOR },
+        { "energy", required_argument, NULL, OPTION_ENERGY },
+        {
+            "horizontal-seams",
+            required_argument,
+            NULL,
+            OPTION_HORIZONTAL_SEAMS
+        },
+        { "order", required_argument, NULL, OPTION_ORDER },
+        { "compare-exact", no_argument, NULL, OPTION_COMPARE_EXACT },
+        { "write-map", required_argument, NULL, OPTION_WRITE_MAP },
+        { "from-map", required_argument, NULL, OPTION_FROM_MAP },
+        { "cache-dir", required_argument, NULL, OPTION_CACHE_DIR },
+        { "cache-size", required_argument, NULL, OPTION_CACHE_SIZE },
+        { "threads", required_argument, NULL, OPTION_THREADS },
+        { "writer-threads", required_argument, NULL, OPTION_WRITER_THREADS },
+        { "y4m", required_argument, NULL, OPTION_Y4M },
+        { "seam-log", required_argument, NULL, OPTION_SEAM_LOG },
+        { "batch", required_argument, NULL, OPTION_BATCH },
+        { "simd", required_argument, NULL, OPTION_SIMD },
+        { "trace", required_argument, NULL, OPTION_TRACE },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "ik:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                options.incremental = 1;
+                break;
+            case 'k':
+                options.seams_per_pass = atoi(optarg);
+                if (options.seams_per_pass < 1) {
+                    fprintf(stderr, "Invalid seams per pass '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_PYRAMID:
+                options.pyramid_levels = atoi(optarg);
+                if (options.pyramid_levels < 0) {
+                    fprintf(stderr, "Invalid pyramid levels '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_CORRIDOR:
+                options.corridor_radius = atoi(optarg);
+                if (options.corridor_radius < 0) {
+                    fprintf(stderr, "Invalid corridor '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_ENERGY:
+                if (carver_parse_energy(optarg, &options.energy)) {
+                    fprintf(stderr, "Unknown energy '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_HORIZONTAL_SEAMS:
+                options.horizontal_seams = atoi(optarg);
+                if (options.horizontal_seams < 0) {
+                    fprintf(
+                            stderr,
+                            "Invalid horizontal seams '%s'\n",
+                            optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_ORDER:
+                if (strcmp(optarg, "sequential") == 0) {
+                    options.ordering = SEQUENTIAL_ORDER;
+                } else if (strcmp(optarg, "greedy") == 0) {
+                    options.ordering = GREEDY_ORDER;
+                } else if (strcmp(optarg, "optimal") == 0) {
+                    options.ordering = OPTIMAL_ORDER;
+                } else {
+                    fprintf(stderr, "Unknown order '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_COMPARE_EXACT:
+                options.compare_exact = 1;
+                break;
+            case OPTION_WRITE_MAP:
+                options.write_map_filename = optarg;
+                break;
+            case OPTION_FROM_MAP:
+                options.from_map_filename = optarg;
+                break;
+            case OPTION_CACHE_DIR:
+                options.cache_directory = optarg;
+                break;
+            case OPTION_CACHE_SIZE:
+                options.cache_size = strtoull(optarg, NULL, 10) * 1024 * 1024;
+                break;
+            case OPTION_THREADS:
+                options.threads = atoi(optarg);
+                if (options.threads < 1) {
+                    fprintf(stderr, "Invalid threads '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_WRITER_THREADS:
+                options.writer_threads = atoi(optarg);
+                if (options.writer_threads < 0) {
+                    fprintf(stderr, "Invalid writer threads '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_Y4M:
+                options.y4m_filename = optarg;
+                break;
+            case OPTION_SEAM_LOG:
+                options.seam_log_filename = optarg;
+                break;
+            case OPTION_BATCH:
+                options.batch_filename = optarg;
+                break;
+            case OPTION_SIMD:
+                if (simd_parse_level(optarg, &options.simd_level)) {
+                    fprintf(stderr, "Unknown SIMD level '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_TRACE:
+                options.trace_filename = optarg;
+                break;
+            default:
+                show_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != (options.batch_filename ? 0 : 3)) {
         show_usage(argv[0]);
         return 1;
     }
 
-    const char *input_filename = argv[1];
-    const char *output_directory = argv[2];
-    int num_iterations = atoi(argv[3]);
+    if (options.incremental && options.seams_per_pass > 1) {
+        fprintf(
+                stderr,
+                "--incremental can't be combined with more than one seam per "
+                "pass\n");
+        return 1;
+    }
+
+    if (options.ordering != SEQUENTIAL_ORDER &&
+            (options.incremental || options.seams_per_pass > 1)) {
+        fprintf(
+                stderr,
+                "--order removes one seam at a time from scratch, and can't "
+                "be combined with --incremental or --seams-per-pass\n");
+        return 1;
+    }
+
+    if (options.energy == CARVER_FORWARD_ENERGY &&
+            (options.horizontal_seams > 0 ||
+             options.ordering != SEQUENTIAL_ORDER ||
+             options.batch_filename)) {
+        // Only vertical seams are found with forward energy.
+        fprintf(
+                stderr,
+                "--energy=forward can't be combined with --horizontal-seams, "
+                "--order or --batch\n");
+        return 1;
+    }
+
+    if (options.pyramid_levels > 0 &&
+            (options.incremental ||
+             options.seams_per_pass > 1 ||
+             options.energy == CARVER_FORWARD_ENERGY)) {
+        fprintf(
+                stderr,
+                "--pyramid can't be combined with --incremental, "
+                "--seams-per-pass or --energy=forward\n");
+        return 1;
+    }
+
+    if (options.incremental &&
+            !carver_energy_is_incremental(options.energy)) {
+        fprintf(
+                stderr,
+                "--incremental can't be combined with --energy=%s\n",
+                carver_energy_name(options.energy));
+        return 1;
+    }
+
+    if (options.horizontal_seams > 0 &&
+            (options.write_map_filename ||
+             options.from_map_filename ||
+             options.cache_directory)) {
+        // Seam order maps only record vertical seams.
+        fprintf(
+                stderr,
+                "--horizontal-seams can't be combined with seam order maps\n");
+        return 1;
+    }
+
+    if (options.y4m_filename && options.seam_log_filename) {
+        fprintf(stderr, "--y4m can't be combined with --seam-log\n");
+        return 1;
+    }
+
+    if (options.batch_filename &&
+            (options.horizontal_seams > 0 ||
+             options.ordering != SEQUENTIAL_ORDER ||
+             options.compare_exact ||
+             options.write_map_filename ||
+             options.from_map_filename ||
+             options.cache_directory ||
+             options.y4m_filename ||
+             options.seam_log_filename)) {
+        // A batch only writes the resized images, with the sizes taken from
+        // the manifest.
+        fprintf(
+                stderr,
+                "--batch can only be combined with --incremental, "
+                "--seams-per-pass, --pyramid, --corridor, --energy, "
+                "--threads, --simd and --trace\n");
+        return 1;
+    }
+
+    if (simd_select(options.simd_level)) {
+        fprintf(
+                stderr,
+                "SIMD level '%s' is not supported by this CPU\n",
+                simd_level_name(options.simd_level));
+        return 1;
+    }
+
+    if (options.batch_filename) { return run_batch(&options); }
+
+    const char *input_filename = argv[optind];
+    const char *output_directory = argv[optind + 1];
+    int num_iterations = atoi(argv[optind + 2]);
 
     int result = 0;
 
     unsigned char *initial_img = NULL;
-    unsigned char *data = NULL;
+    unsigned char *map_contents = NULL;
+    unsigned char *exact_img = NULL;
+    struct carver *carver = NULL;
+    struct carver *exact_carver = NULL;
+    struct frame_writer *frame_writer = NULL;
+    struct thread_pool *pool = NULL;
+    struct trace *trace = NULL;
+    FILE *y4m_stream = NULL;
+    struct seam_log_writer *seam_log = NULL;
+
+    if (options.y4m_filename &&
+            !(y4m_stream = frame_writer_open_stream(options.y4m_filename))) {
+        result = 1;
+        goto cleanup;
+    }
+
+    if (options.trace_filename && !(trace = trace_create())) {
+        result = 1;
+        goto cleanup;
+    }
 
     printf("Reading '%s'\n", input_filename);
 
-    int w, h, n;
-    initial_img = stbi_load(input_filename, &w, &h, &n, 3);
+    int w, h;
+    initial_img = load_image_traced(trace, input_filename, &w, &h);
     if (!initial_img) {
         fprintf(stderr, "Unable to read '%s'\n", input_filename);
 
@@ -364,26 +1088,268 @@ int main(int argc, char **argv) {
 
     printf("Loaded %dx%d image\n", w, h);
 
-    data = initial_img;
-    for (int i = 0; i < num_iterations; i++) {
-        unsigned char *next_data =
-            run_iteration(output_directory, data, w, h, i);
+    if (num_iterations < 0 || num_iterations >= w) {
+        fprintf(
+                stderr,
+                "Unable to remove %d vertical seams from a %d pixel wide "
+                "image\n",
+                num_iterations,
+                w);
+
+        result = 1;
+        goto cleanup;
+    }
 
-        if (!next_data) {
-            fprintf(stderr, "Error running iteration %d\n", i);
+    if (options.horizontal_seams >= h) {
+        fprintf(
+                stderr,
+                "Unable to remove %d horizontal seams from a %d pixel tall "
+                "image\n",
+                options.horizontal_seams,
+                h);
+
+        result = 1;
+        goto cleanup;
+    }
+
+    char resized_output_filename[1024];
+    snprintf(resized_output_filename, 1024, "%s/img.jpg", output_directory);
+
+    if (options.from_map_filename) {
+        struct seam_order_map map;
+        map_contents = load_seam_order_map(options.from_map_filename, &map);
+
+        result = !map_contents || resize_with_seam_order_map(
+                &map,
+                initial_img,
+                w,
+                h,
+                num_iterations,
+                resized_output_filename);
+        goto cleanup;
+    }
+
+    unsigned long long cache_key = 0;
+    if (options.cache_directory) {
+        char parameters[256];
+        cache_parameters(&options, parameters, sizeof(parameters));
+        cache_key = seam_cache_key(initial_img, w, h, parameters);
+
+        struct seam_cache_entry entry;
+        if (!seam_cache_lookup(options.cache_directory, cache_key, &entry)) {
+            if (entry.map.num_seams >= num_iterations) {
+                printf(
+                        "Found seam order map %016llx in the cache\n",
+                        cache_key);
+
+                result = resize_with_seam_order_map(
+                        &entry.map,
+                        initial_img,
+                        w,
+                        h,
+                        num_iterations,
+                        resized_output_filename);
+                seam_cache_release(&entry);
+                goto cleanup;
+            }
+
+            // The cached map doesn't contain enough seams, so it is replaced
+            // by the map from this run.
+            seam_cache_release(&entry);
+        }
+    }
+
+    printf("Using %s kernels\n", simd_level_name(options.simd_level));
+
+    // The same threads are used for every iteration, and for both carvers.
+    pool = thread_pool_create(options.threads);
+    if (!pool) {
+        result = 1;
+        goto cleanup;
+    }
+
+    printf("Using %d threads\n", thread_pool_num_threads(pool));
+
+    if (options.compare_exact) {
+        exact_img = malloc(w * h * 3);
+        if (!exact_img) {
+            fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
 
             result = 1;
             goto cleanup;
         }
 
-        if (i > 0) { free(data); }
-        data = next_data;
-        w--;
+        memcpy(exact_img, initial_img, w * h * 3);
     }
 
-    char resized_output_filename[1024];
-    snprintf(resized_output_filename, 1024, "%s/img.jpg", output_directory);
-    if (!draw_image(data, w, h, resized_output_filename)) {
+    // The seams are removed in place, directly in the decoded image.
+    carver = carver_create(
+            initial_img,
+            w,
+            h,
+            options.energy,
+            options.incremental,
+            options.seams_per_pass,
+            options.pyramid_levels,
+            options.corridor_radius,
+            options.write_map_filename || options.cache_directory,
+            pool,
+            trace);
+    if (!carver) {
+        result = 1;
+        goto cleanup;
+    }
+
+    struct visualization visualization = {
+        .output_directory = output_directory,
+        .carver = carver,
+        .frame_writer = NULL,
+        .seam_log = NULL
+    };
+
+    if (options.seam_log_filename) {
+        seam_log = seam_log_writer_create(
+                options.seam_log_filename,
+                initial_img,
+                w,
+                h,
+                w);
+        if (!seam_log) {
+            result = 1;
+            goto cleanup;
+        }
+
+        visualization.seam_log = seam_log;
+    } else {
+        // Each pending frame holds a full copy of the image, so only a few
+        // frames per thread are allowed to pile up. Without any threads, the
+        // only pending frame is the one being written.
+        frame_writer = frame_writer_create(
+                options.writer_threads,
+                options.writer_threads > 0 ? options.writer_threads * 2 : 1);
+        if (!frame_writer) {
+            result = 1;
+            goto cleanup;
+        }
+
+        visualization.frame_writer = frame_writer;
+        frame_writer_set_trace(frame_writer, trace);
+
+        // The video frames stay the size of the original image, so the
+        // animation doesn't need any padding later on.
+        if (y4m_stream &&
+                frame_writer_open_y4m(frame_writer, y4m_stream, w, h)) {
+            result = 1;
+            goto cleanup;
+        }
+    }
+
+    carver_set_iteration_callback(carver, visualize_iteration, &visualization);
+
+    if (options.ordering == SEQUENTIAL_ORDER) {
+        result = carver_remove_vertical_seams(carver, num_iterations) ||
+            carver_remove_horizontal_seams(carver, options.horizontal_seams);
+    } else {
+        result = remove_seams_in_best_order(
+                carver,
+                options.ordering,
+                num_iterations,
+                options.horizontal_seams);
+    }
+
+    // All the frames are written before the final image, even on error.
+    if (frame_writer_finish(frame_writer)) { result = 1; }
+    frame_writer = NULL;
+    if (seam_log_writer_finish(seam_log)) { result = 1; }
+    seam_log = NULL;
+
+    if (result) { goto cleanup; }
+
+    if (options.write_map_filename &&
+            write_seam_order_map(
+                options.write_map_filename,
+                carver_removal_order(carver),
+                w,
+                h,
+                carver_num_seams_removed(carver))) {
+        result = 1;
+        goto cleanup;
+    }
+
+    if (options.cache_directory &&
+            seam_cache_store(
+                options.cache_directory,
+                cache_key,
+                carver_removal_order(carver),
+                w,
+                h,
+                carver_num_seams_removed(carver),
+                options.cache_size)) {
+        result = 1;
+        goto cleanup;
+    }
+
+    printf("Total seam energy: %llu\n", carver_total_seam_energy(carver));
+
+    if (options.compare_exact) {
+        // The seams are removed in the same order as above. Incremental
+        // carving finds the same seams faster, but only with some of the
+        // energies, and only in the sequential order.
+        int exact_incremental =
+            options.ordering == SEQUENTIAL_ORDER &&
+            carver_energy_is_incremental(options.energy);
+        exact_carver = carver_create(
+                exact_img,
+                w,
+                h,
+                options.energy,
+                exact_incremental,
+                1,
+                0,
+                0,
+                0,
+                pool,
+                trace);
+        if (!exact_carver) {
+            result = 1;
+            goto cleanup;
+        }
+
+        if (options.ordering == SEQUENTIAL_ORDER) {
+            result =
+                carver_remove_vertical_seams(exact_carver, num_iterations) ||
+                carver_remove_horizontal_seams(
+                        exact_carver,
+                        options.horizontal_seams);
+        } else {
+            result = remove_seams_in_best_order(
+                    exact_carver,
+                    options.ordering,
+                    num_iterations,
+                    options.horizontal_seams);
+        }
+
+        if (result) { goto cleanup; }
+
+        unsigned long long exact_energy =
+            carver_total_seam_energy(exact_carver);
+        long long difference =
+            (long long) carver_total_seam_energy(carver) -
+            (long long) exact_energy;
+
+        printf("Total seam energy removing one seam at a time: %llu\n",
+                exact_energy);
+        printf("Difference: %+lld (%+.2f%%)\n",
+                difference,
+                exact_energy ? 100.0 * difference / exact_energy : 0.0);
+    }
+
+    carver_compact_image(carver);
+
+    if (!draw_image_traced(
+                trace,
+                carver_image(carver),
+                resized_output_filename)) {
         fprintf(
                 stderr,
                 "\033[1;31mUnable to write %s\033[0m\n",
@@ -391,8 +1357,20 @@ int main(int argc, char **argv) {
     }
 
 cleanup:
+    frame_writer_finish(frame_writer);
+    seam_log_writer_finish(seam_log);
+    if (y4m_stream && fclose(y4m_stream)) {
+        fprintf(stderr, "Unable to write video stream\n");
+        result = 1;
+    }
+    if (finish_trace(trace, options.trace_filename)) { result = 1; }
+    trace_free(trace);
+    carver_free(carver);
+    carver_free(exact_carver);
+    thread_pool_free(pool);
     if (initial_img) { stbi_image_free(initial_img); }
-    if (data && data != initial_img) { free(data); }
+    if (map_contents) { free(map_contents); }
+    if (exact_img) { free(exact_img); }
 
     return result;
 }
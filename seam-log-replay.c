@@ -0,0 +1,174 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "frame-writer.h"
+#include "seam-log.h"
+
+// Reconstructs the seam visualization frames from a seam log written by
+// `seam-carver --seam-log`, either as individual JPEGs or as a YUV4MPEG2
+// video.
+
+void show_usage(const char *program) {
+    fprintf(
+            stderr,
+            "USAGE:\n"
+            "  %s [options] <seam-log> <output-directory>\n"
+            "\n"
+            "OPTIONS:\n"
+            "  --frame=<n>        only write the seam image of iteration n\n"
+            "  --writer-threads=<n>\n"
+            "                     number of background threads encoding the\n"
+            "                     seam images, or 0 to encode them on the\n"
+            "                     main thread (default: 2)\n"
+            "  --y4m=<file>       write the seam images as a YUV4MPEG2 video\n"
+            "                     to <file>, or to standard output if <file>\n"
+            "                     is -, instead of as individual JPEGs\n",
+            program);
+}
+
+struct options {
+    int frame;
+    int writer_threads;
+    const char *y4m_filename;
+};
+
+enum {
+    OPTION_FRAME = 256,
+    OPTION_WRITER_THREADS,
+    OPTION_Y4M
+};
+
+int main(int argc, char **argv) {
+    struct options options = {
+        .frame = -1,
+        .writer_threads = 2,
+        .y4m_filename = NULL
+    };
+
+    static const struct option long_options[] = {
+        { "frame", required_argument, NULL, OPTION_FRAME },
+        { "writer-threads", required_argument, NULL, OPTION_WRITER_THREADS },
+        { "y4m", required_argument, NULL, OPTION_Y4M },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case OPTION_FRAME:
+                options.frame = atoi(optarg);
+                if (options.frame < 0) {
+                    fprintf(stderr, "Invalid frame '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_WRITER_THREADS:
+                options.writer_threads = atoi(optarg);
+                if (options.writer_threads < 0) {
+                    fprintf(stderr, "Invalid writer threads '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_Y4M:
+                options.y4m_filename = optarg;
+                break;
+            default:
+                show_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        show_usage(argv[0]);
+        return 1;
+    }
+
+    const char *log_filename = argv[optind];
+    const char *output_directory = argv[optind + 1];
+
+    int result = 0;
+
+    FILE *y4m_stream = NULL;
+    struct seam_log *log = NULL;
+    struct frame_writer *frame_writer = NULL;
+
+    if (options.y4m_filename &&
+            !(y4m_stream = frame_writer_open_stream(options.y4m_filename))) {
+        result = 1;
+        goto cleanup;
+    }
+
+    printf("Reading '%s'\n", log_filename);
+
+    log = seam_log_open(log_filename);
+    if (!log) {
+        result = 1;
+        goto cleanup;
+    }
+
+    int num_frames = seam_log_num_frames(log);
+    if (options.frame >= num_frames) {
+        fprintf(stderr, "The seam log only contains %d frames\n", num_frames);
+
+        result = 1;
+        goto cleanup;
+    }
+
+    frame_writer = frame_writer_create(
+            options.writer_threads,
+            options.writer_threads > 0 ? options.writer_threads * 2 : 1);
+    if (!frame_writer) {
+        result = 1;
+        goto cleanup;
+    }
+
+    struct seam_log_frame frame;
+
+    // The first frame has the dimensions of the original image, which every
+    // frame of the video is padded to.
+    if (y4m_stream && num_frames > 0 &&
+            (seam_log_read_frame(log, 0, &frame) ||
+             frame_writer_open_y4m(
+                 frame_writer,
+                 y4m_stream,
+                 frame.w,
+                 frame.h))) {
+        result = 1;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < num_frames; i++) {
+        if (options.frame >= 0 && i != options.frame) { continue; }
+
+        seam_log_read_frame(log, i, &frame);
+
+        if (frame_writer_write_iteration(
+                    frame_writer,
+                    frame.data,
+                    frame.w,
+                    frame.h,
+                    frame.stride,
+                    frame.direction,
+                    frame.seams,
+                    frame.num_seams,
+                    output_directory,
+                    i)) {
+            result = 1;
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    if (frame_writer_finish(frame_writer)) { result = 1; }
+    if (y4m_stream && fclose(y4m_stream)) {
+        fprintf(stderr, "Unable to write video stream\n");
+        result = 1;
+    }
+    seam_log_close(log);
+
+    return result;
+}
@@ -0,0 +1,490 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seam-log.h"
+
+#define SEAM_LOG_VERSION 1
+
+static unsigned int read_le32(const unsigned char *bytes) {
+    return bytes[0] |
+        (bytes[1] << 8) |
+        (bytes[2] << 16) |
+        ((unsigned int) bytes[3] << 24);
+}
+
+static void write_le32(unsigned char *bytes, unsigned int value) {
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+}
+
+static size_t encoded_seam_size(int h) {
+    return 4 + (h + 2) / 4;
+}
+
+// The highest bit of the number of seams in a frame marks horizontal seams.
+#define SEAM_LOG_HORIZONTAL 0x80000000u
+
+// WRITER /////////////////////////////////////////////////////////////////////
+
+struct seam_log_writer {
+    FILE *file;
+    const char *filename;
+
+    // The dimensions of the image the next frame's seams are removed from.
+    int w;
+    int h;
+
+    int num_frames;
+    int failed;
+
+    // Scratch space for encoding one seam.
+    unsigned char *encoded_seam;
+};
+
+static int free_writer(struct seam_log_writer *writer) {
+    int failed = writer->failed;
+    if (writer->file && fclose(writer->file)) { failed = 1; }
+    if (writer->encoded_seam) { free(writer->encoded_seam); }
+    free(writer);
+
+    return failed;
+}
+
+struct seam_log_writer * seam_log_writer_create(
+        const char *filename,
+        const unsigned char *data,
+        int w,
+        int h,
+        int stride) {
+    struct seam_log_writer *writer = calloc(1, sizeof(struct seam_log_writer));
+    if (!writer) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return NULL;
+    }
+
+    writer->filename = filename;
+    writer->w = w;
+    writer->h = h;
+
+    writer->encoded_seam = malloc(encoded_seam_size(w > h ? w : h));
+    if (!writer->encoded_seam) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        free_writer(writer);
+        return NULL;
+    }
+
+    unsigned char header[SEAM_LOG_HEADER_SIZE];
+    memcpy(header, "SCLG", 4);
+    write_le32(header + 4, SEAM_LOG_VERSION);
+    write_le32(header + 8, w);
+    write_le32(header + 12, h);
+    write_le32(header + 16, 0);
+
+    printf("Writing seam log to '%s'\n", filename);
+
+    writer->file = fopen(filename, "wb");
+    int failed = !writer->file ||
+        fwrite(header, 1, sizeof(header), writer->file) != sizeof(header);
+    for (int y = 0; y < h && !failed; y++) {
+        failed = fwrite(data + y * stride * 3, 3, w, writer->file) !=
+            (size_t) w;
+    }
+
+    if (failed) {
+        fprintf(stderr, "Unable to write '%s'\n", filename);
+
+        free_writer(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+int seam_log_append(
+        struct seam_log_writer *writer,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams) {
+    int seam_length = direction == VERTICAL_SEAMS ? writer->h : writer->w;
+    size_t size = encoded_seam_size(seam_length);
+
+    unsigned char count[4];
+    write_le32(
+            count,
+            num_seams | (direction == HORIZONTAL_SEAMS ?
+                SEAM_LOG_HORIZONTAL :
+                0));
+    int failed = fwrite(count, 1, 4, writer->file) != 4;
+
+    for (int seam = 0; seam < num_seams && !failed; seam++) {
+        const int *coordinates = seams + seam * seam_length;
+        unsigned char *encoded = writer->encoded_seam;
+
+        memset(encoded, 0, size);
+        write_le32(encoded, coordinates[0]);
+
+        for (int i = 1; i < seam_length; i++) {
+            int shift = ((i - 1) % 4) * 2;
+            int step = coordinates[i] - coordinates[i - 1];
+            encoded[4 + (i - 1) / 4] |= (step + 1) << shift;
+        }
+
+        failed = fwrite(encoded, 1, size, writer->file) != size;
+    }
+
+    if (failed) {
+        fprintf(stderr, "Unable to write '%s'\n", writer->filename);
+        writer->failed = 1;
+        return 1;
+    }
+
+    if (direction == VERTICAL_SEAMS) {
+        writer->w -= num_seams;
+    } else {
+        writer->h -= num_seams;
+    }
+
+    writer->num_frames++;
+    return 0;
+}
+
+int seam_log_writer_finish(struct seam_log_writer *writer) {
+    if (!writer) { return 0; }
+
+    const char *filename = writer->filename;
+
+    unsigned char num_frames[4];
+    write_le32(num_frames, writer->num_frames);
+
+    if (fseek(writer->file, 16, SEEK_SET) ||
+            fwrite(num_frames, 1, 4, writer->file) != 4) {
+        writer->failed = 1;
+    }
+
+    int result = free_writer(writer);
+    if (result) {
+        fprintf(stderr, "Unable to write '%s'\n", filename);
+    }
+
+    return result;
+}
+
+// READER /////////////////////////////////////////////////////////////////////
+
+struct frame_index {
+    // The offset of the frame within the contents.
+    size_t offset;
+
+    // The dimensions of the image the frame's seams are removed from.
+    int w;
+    int h;
+};
+
+struct seam_log {
+    unsigned char *contents;
+
+    int w;
+    int h;
+    int num_frames;
+    struct frame_index *frames;
+
+    // The image at the start of `current_frame`, with the same stride as the
+    // original image.
+    unsigned char *img;
+    int img_w;
+    int img_h;
+    int current_frame;
+
+    // The decoded seams of the last frame read, with room for the largest
+    // frame.
+    int *seams;
+};
+
+static const unsigned char * original_image(const struct seam_log *log) {
+    return log->contents + SEAM_LOG_HEADER_SIZE;
+}
+
+static void decode_seams(
+        const struct seam_log *log,
+        int frame,
+        enum seam_direction *direction,
+        int *seams,
+        int *num_seams) {
+    const struct frame_index *index = &log->frames[frame];
+    const unsigned char *bytes = log->contents + index->offset;
+
+    unsigned int count = read_le32(bytes);
+    bytes += 4;
+
+    *direction =
+        count & SEAM_LOG_HORIZONTAL ? HORIZONTAL_SEAMS : VERTICAL_SEAMS;
+    *num_seams = count & ~SEAM_LOG_HORIZONTAL;
+
+    int seam_length = *direction == VERTICAL_SEAMS ? index->h : index->w;
+
+    for (int seam = 0; seam < *num_seams; seam++) {
+        int *coordinates = seams + seam * seam_length;
+
+        coordinates[0] = read_le32(bytes);
+        for (int i = 1; i < seam_length; i++) {
+            int shift = ((i - 1) % 4) * 2;
+            int step = ((bytes[4 + (i - 1) / 4] >> shift) & 3) - 1;
+            coordinates[i] = coordinates[i - 1] + step;
+        }
+
+        bytes += encoded_seam_size(seam_length);
+    }
+}
+
+static void remove_seams(
+        struct seam_log *log,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams) {
+    // The seams are sorted and never cross, so each row, or each column for
+    // horizontal seams, is compacted in a single pass. Columns are strided,
+    // but replaying the log is not nearly as performance-sensitive as the
+    // carving itself.
+    int vertical = direction == VERTICAL_SEAMS;
+    int num_lines = vertical ? log->img_h : log->img_w;
+    int line_length = vertical ? log->img_w : log->img_h;
+    size_t line_stride = vertical ? (size_t) log->w * 3 : 3;
+    size_t pixel_stride = vertical ? 3 : (size_t) log->w * 3;
+
+    for (int line = 0; line < num_lines; line++) {
+        unsigned char *pixels = log->img + line * line_stride;
+        int d = num_lines - 1 - line;
+        int dst = seams[d];
+
+        for (int i = 0; i < num_seams; i++) {
+            int src = seams[i * num_lines + d] + 1;
+            int src_end =
+                i + 1 < num_seams ? seams[(i + 1) * num_lines + d] :
+                line_length;
+
+            for (; src < src_end; src++, dst++) {
+                memcpy(
+                        pixels + dst * pixel_stride,
+                        pixels + src * pixel_stride,
+                        3);
+            }
+        }
+    }
+
+    if (vertical) {
+        log->img_w -= num_seams;
+    } else {
+        log->img_h -= num_seams;
+    }
+}
+
+static int index_frames(struct seam_log *log, size_t size) {
+    // Records where each frame starts, checking that every seam fits in the
+    // image it is removed from, and that the seams of a frame are sorted and
+    // never cross.
+    size_t offset =
+        SEAM_LOG_HEADER_SIZE + (size_t) log->w * log->h * 3;
+    int w = log->w;
+    int h = log->h;
+    size_t max_seams_size = 1;
+
+    for (int frame = 0; frame < log->num_frames; frame++) {
+        if (size - offset < 4) { return 1; }
+
+        unsigned int count = read_le32(log->contents + offset);
+        int vertical = !(count & SEAM_LOG_HORIZONTAL);
+        unsigned int num_seams = count & ~SEAM_LOG_HORIZONTAL;
+        int seam_length = vertical ? h : w;
+        size_t seam_size = encoded_seam_size(seam_length);
+
+        if (num_seams >= (unsigned int) (vertical ? w : h) ||
+                (size - offset - 4) / seam_size < num_seams) {
+            return 1;
+        }
+
+        log->frames[frame] = (struct frame_index) {
+            .offset = offset,
+            .w = w,
+            .h = h
+        };
+        offset += 4 + num_seams * seam_size;
+
+        if (vertical) {
+            w -= num_seams;
+        } else {
+            h -= num_seams;
+        }
+
+        if (num_seams * seam_length > max_seams_size) {
+            max_seams_size = num_seams * seam_length;
+        }
+    }
+
+    if (offset != size) { return 1; }
+
+    log->seams = malloc(max_seams_size * sizeof(int));
+    if (!log->seams) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return 1;
+    }
+
+    // The coordinates can only be checked by decoding the seams.
+    for (int frame = 0; frame < log->num_frames; frame++) {
+        enum seam_direction direction;
+        int num_seams;
+        decode_seams(log, frame, &direction, log->seams, &num_seams);
+
+        const struct frame_index *index = &log->frames[frame];
+        int vertical = direction == VERTICAL_SEAMS;
+        int seam_length = vertical ? index->h : index->w;
+        int limit = vertical ? index->w : index->h;
+
+        for (int seam = 0; seam < num_seams; seam++)
+        for (int i = 0; i < seam_length; i++) {
+            int coordinate = log->seams[seam * seam_length + i];
+            int previous_coordinate =
+                seam > 0 ? log->seams[(seam - 1) * seam_length + i] : -1;
+
+            if (coordinate <= previous_coordinate || coordinate >= limit) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+struct seam_log * seam_log_open(const char *filename) {
+    struct seam_log *log = calloc(1, sizeof(struct seam_log));
+    if (!log) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return NULL;
+    }
+
+    long size = 0;
+
+    FILE *file = fopen(filename, "rb");
+    if (!file ||
+            fseek(file, 0, SEEK_END) ||
+            (size = ftell(file)) < 0 ||
+            fseek(file, 0, SEEK_SET)) {
+        fprintf(stderr, "Unable to read '%s'\n", filename);
+        goto error;
+    }
+
+    log->contents = malloc(size > 0 ? size : 1);
+    if (!log->contents) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        goto error;
+    }
+
+    if (fread(log->contents, 1, size, file) != (size_t) size ||
+            size < SEAM_LOG_HEADER_SIZE ||
+            memcmp(log->contents, "SCLG", 4) != 0 ||
+            read_le32(log->contents + 4) != SEAM_LOG_VERSION) {
+        fprintf(stderr, "Invalid seam log '%s'\n", filename);
+        goto error;
+    }
+
+    unsigned int w = read_le32(log->contents + 8);
+    unsigned int h = read_le32(log->contents + 12);
+    unsigned int num_frames = read_le32(log->contents + 16);
+
+    if (w == 0 || h == 0 || w > INT_MAX / 3 / h ||
+            (size_t) size - SEAM_LOG_HEADER_SIZE < (size_t) w * h * 3 ||
+            num_frames > (size_t) size / 4) {
+        fprintf(stderr, "Invalid seam log '%s'\n", filename);
+        goto error;
+    }
+
+    log->w = w;
+    log->h = h;
+    log->num_frames = num_frames;
+
+    log->frames = malloc((num_frames + 1) * sizeof(struct frame_index));
+    log->img = malloc((size_t) w * h * 3);
+    if (!log->frames || !log->img) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        goto error;
+    }
+
+    if (index_frames(log, size)) {
+        fprintf(stderr, "Invalid seam log '%s'\n", filename);
+        goto error;
+    }
+
+    memcpy(log->img, original_image(log), (size_t) w * h * 3);
+    log->img_w = w;
+    log->img_h = h;
+    log->current_frame = 0;
+
+    fclose(file);
+    return log;
+
+error:
+    if (file) { fclose(file); }
+    seam_log_close(log);
+
+    return NULL;
+}
+
+void seam_log_close(struct seam_log *log) {
+    if (!log) { return; }
+
+    if (log->contents) { free(log->contents); }
+    if (log->frames) { free(log->frames); }
+    if (log->img) { free(log->img); }
+    if (log->seams) { free(log->seams); }
+    free(log);
+}
+
+int seam_log_num_frames(const struct seam_log *log) {
+    return log->num_frames;
+}
+
+int seam_log_read_frame(
+        struct seam_log *log,
+        int frame,
+        struct seam_log_frame *output) {
+    if (frame < 0 || frame >= log->num_frames) { return 1; }
+
+    // The removals can't be undone, so going backwards starts over from the
+    // original image.
+    if (frame < log->current_frame) {
+        memcpy(log->img, original_image(log), (size_t) log->w * log->h * 3);
+        log->img_w = log->w;
+        log->img_h = log->h;
+        log->current_frame = 0;
+    }
+
+    enum seam_direction direction;
+    int num_seams;
+    for (; log->current_frame < frame; log->current_frame++) {
+        decode_seams(
+                log,
+                log->current_frame,
+                &direction,
+                log->seams,
+                &num_seams);
+        remove_seams(log, direction, log->seams, num_seams);
+    }
+
+    decode_seams(log, frame, &direction, log->seams, &num_seams);
+
+    *output = (struct seam_log_frame) {
+        .data = log->img,
+        .w = log->img_w,
+        .h = log->img_h,
+        .stride = log->w,
+        .direction = direction,
+        .seams = log->seams,
+        .num_seams = num_seams
+    };
+
+    return 0;
+}
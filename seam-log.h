@@ -0,0 +1,99 @@
+#ifndef SEAM_LOG_H
+#define SEAM_LOG_H
+
+#include "seams.h"
+
+// A seam log is a compact record of a carving run, from which any of the seam
+// visualization frames can be reconstructed later, instead of encoding every
+// frame while carving.
+//
+// The log stores the original image once, followed by the seams removed on
+// each iteration. Adjacent rows of a vertical seam are always at most one
+// pixel apart, so each seam is stored as the X coordinate of its bottom row,
+// followed by the -1, 0 or +1 step to each row above it, packed 2 bits per
+// row. Horizontal seams are stored the same way, starting from the Y
+// coordinate of the rightmost column, following the layout in `seams.h`. All
+// the integers are little-endian.
+//
+//   offset  size  contents
+//        0     4  "SCLG"
+//        4     4  version, currently 1
+//        8     4  width of the original image
+//       12     4  height of the original image
+//       16     4  number of frames
+//       20  w*h*3 the original image, as contiguous RGB pixels
+//
+// Each frame then consists of:
+//
+//   size          contents
+//      4          number of seams in the frame, with the highest bit set if
+//                 the seams are horizontal
+//
+// followed by, for each seam of length n, sorted as in `seams.h`:
+//
+//   size          contents
+//      4          the first coordinate of the seam
+//      (n + 2)/4  the steps from each coordinate to the next, stored as
+//                 step + 1, starting from the lowest bits of the first byte
+//
+// The seams of a frame are in the coordinates of the image after the seams
+// of all the previous frames are removed, so the length of a seam is the
+// current height of the image for vertical seams, and the current width for
+// horizontal seams.
+
+#define SEAM_LOG_HEADER_SIZE 20
+
+struct seam_log_writer;
+struct seam_log;
+
+// Creates a log, writing the header and the RGB image, with `stride` pixels
+// from the start of one row to the start of the next. Returns NULL on error.
+struct seam_log_writer * seam_log_writer_create(
+        const char *filename,
+        const unsigned char *data,
+        int w,
+        int h,
+        int stride);
+
+// Appends a frame with the given seams, laid out as described in `seams.h`.
+// Returns non-zero on error.
+int seam_log_append(
+        struct seam_log_writer *writer,
+        enum seam_direction direction,
+        const int *seams,
+        int num_seams);
+
+// Records the number of frames, then closes the file and frees the writer.
+// Returns non-zero if any part of the log failed to be written.
+int seam_log_writer_finish(struct seam_log_writer *writer);
+
+// A reconstructed frame: the image at the start of an iteration, along with
+// the seams removed in that iteration.
+struct seam_log_frame {
+    const unsigned char *data;
+    int w;
+    int h;
+    int stride;
+
+    enum seam_direction direction;
+    const int *seams;
+    int num_seams;
+};
+
+// Reads and validates a log. Returns NULL on error.
+struct seam_log * seam_log_open(const char *filename);
+
+void seam_log_close(struct seam_log *log);
+
+int seam_log_num_frames(const struct seam_log *log);
+
+// Reconstructs a frame, valid until the next call. Frames are reconstructed
+// by replaying the seam removals, continuing from the last frame read when
+// possible, so reading the frames in order only replays each removal once.
+// Returns non-zero if the frame doesn't exist.
+int seam_log_read_frame(
+        struct seam_log *log,
+        int frame,
+        struct seam_log_frame *output);
+
+#endif
@@ -0,0 +1,254 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seam-order.h"
+
+#define SEAM_ORDER_VERSION 1
+
+static unsigned int read_le32(const unsigned char *bytes) {
+    return bytes[0] |
+        (bytes[1] << 8) |
+        (bytes[2] << 16) |
+        ((unsigned int) bytes[3] << 24);
+}
+
+static void write_le32(unsigned char *bytes, unsigned int value) {
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+}
+
+unsigned int seam_order_at(const struct seam_order_map *map, int x, int y) {
+    const unsigned char *entry =
+        map->entries + (y * map->w + x) * map->bytes_per_entry;
+
+    switch (map->bytes_per_entry) {
+        case 1: return entry[0];
+        case 2: return entry[0] | (entry[1] << 8);
+        default: return read_le32(entry);
+    }
+}
+
+int write_seam_order_map(
+        const char *filename,
+        const unsigned int *removal_order,
+        int w,
+        int h,
+        int num_seams) {
+    int result = 0;
+
+    int bytes_per_entry =
+        num_seams <= UCHAR_MAX ? 1 :
+        num_seams <= USHRT_MAX ? 2 :
+        4;
+
+    unsigned char *contents = NULL;
+    size_t size = SEAM_ORDER_HEADER_SIZE + (size_t) w * h * bytes_per_entry;
+    FILE *file = NULL;
+
+    contents = malloc(size);
+    if (!contents) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        result = 1;
+        goto cleanup;
+    }
+
+    memcpy(contents, "SCMP", 4);
+    write_le32(contents + 4, SEAM_ORDER_VERSION);
+    write_le32(contents + 8, w);
+    write_le32(contents + 12, h);
+    write_le32(contents + 16, num_seams);
+    write_le32(contents + 20, bytes_per_entry);
+
+    unsigned char *entry = contents + SEAM_ORDER_HEADER_SIZE;
+    for (int i = 0; i < w * h; i++, entry += bytes_per_entry) {
+        unsigned int order =
+            removal_order[i] < (unsigned int) num_seams ?
+            removal_order[i] :
+            (unsigned int) num_seams;
+
+        switch (bytes_per_entry) {
+            case 1:
+                entry[0] = order;
+                break;
+            case 2:
+                entry[0] = order;
+                entry[1] = order >> 8;
+                break;
+            default:
+                write_le32(entry, order);
+                break;
+        }
+    }
+
+    printf("Writing seam order map to '%s'\n", filename);
+
+    file = fopen(filename, "wb");
+    if (!file || fwrite(contents, 1, size, file) != size) {
+        fprintf(stderr, "Unable to write '%s'\n", filename);
+
+        result = 1;
+        goto cleanup;
+    }
+
+cleanup:
+    if (file && fclose(file)) {
+        fprintf(stderr, "Unable to write '%s'\n", filename);
+        result = 1;
+    }
+    if (contents) { free(contents); }
+
+    return result;
+}
+
+static int check_seam_order_rows(const struct seam_order_map *map) {
+    // Returns non-zero unless every row removes each of the seams exactly
+    // once and keeps every other pixel, so applying the map always yields
+    // rows exactly `num_seams` pixels shorter.
+    int result = 0;
+
+    // The last row each seam was seen in.
+    int *seam_rows = malloc(
+            (map->num_seams > 0 ? map->num_seams : 1) * sizeof(int));
+    if (!seam_rows) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return 1;
+    }
+
+    for (int i = 0; i < map->num_seams; i++) { seam_rows[i] = -1; }
+
+    for (int y = 0; y < map->h; y++) {
+        int num_removed = 0;
+
+        for (int x = 0; x < map->w; x++) {
+            unsigned int order = seam_order_at(map, x, y);
+            if (order > (unsigned int) map->num_seams) {
+                result = 1;
+                goto cleanup;
+            }
+
+            if (order < (unsigned int) map->num_seams) {
+                if (seam_rows[order] == y) {
+                    result = 1;
+                    goto cleanup;
+                }
+
+                seam_rows[order] = y;
+                num_removed++;
+            }
+        }
+
+        if (num_removed != map->num_seams) {
+            result = 1;
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    free(seam_rows);
+
+    return result;
+}
+
+int parse_seam_order_map(
+        const unsigned char *contents,
+        size_t size,
+        struct seam_order_map *map) {
+    if (size < SEAM_ORDER_HEADER_SIZE ||
+            memcmp(contents, "SCMP", 4) != 0 ||
+            read_le32(contents + 4) != SEAM_ORDER_VERSION) {
+        return 1;
+    }
+
+    unsigned int w = read_le32(contents + 8);
+    unsigned int h = read_le32(contents + 12);
+    unsigned int num_seams = read_le32(contents + 16);
+    unsigned int bytes_per_entry = read_le32(contents + 20);
+
+    if (bytes_per_entry != 1 && bytes_per_entry != 2 && bytes_per_entry != 4) {
+        return 1;
+    }
+
+    // The entries must fill the rest of the file exactly, without a partial
+    // entry at the end.
+    if (w == 0 || h == 0 || w > INT_MAX / h || num_seams >= w ||
+            size - SEAM_ORDER_HEADER_SIZE !=
+                (size_t) w * h * bytes_per_entry) {
+        return 1;
+    }
+
+    struct seam_order_map parsed = {
+        .w = w,
+        .h = h,
+        .num_seams = num_seams,
+        .bytes_per_entry = bytes_per_entry,
+        .entries = contents + SEAM_ORDER_HEADER_SIZE
+    };
+
+    if (check_seam_order_rows(&parsed)) { return 1; }
+
+    *map = parsed;
+
+    return 0;
+}
+
+unsigned char * load_seam_order_map(
+        const char *filename,
+        struct seam_order_map *map) {
+    unsigned char *contents = NULL;
+    long size = 0;
+
+    FILE *file = fopen(filename, "rb");
+    if (!file ||
+            fseek(file, 0, SEEK_END) ||
+            (size = ftell(file)) < 0 ||
+            fseek(file, 0, SEEK_SET)) {
+        fprintf(stderr, "Unable to read '%s'\n", filename);
+        goto cleanup;
+    }
+
+    contents = malloc(size > 0 ? size : 1);
+    if (!contents) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        goto cleanup;
+    }
+
+    if (fread(contents, 1, size, file) != (size_t) size ||
+            parse_seam_order_map(contents, size, map)) {
+        fprintf(stderr, "Invalid seam order map '%s'\n", filename);
+
+        free(contents);
+        contents = NULL;
+        goto cleanup;
+    }
+
+cleanup:
+    if (file) { fclose(file); }
+
+    return contents;
+}
+
+void apply_seam_order_map(
+        const struct seam_order_map *map,
+        const unsigned char *data,
+        int num_seams,
+        unsigned char *output) {
+    for (int y = 0; y < map->h; y++) {
+        const unsigned char *pixel = data + y * map->w * 3;
+
+        for (int x = 0; x < map->w; x++, pixel += 3) {
+            if (seam_order_at(map, x, y) < (unsigned int) num_seams) {
+                continue;
+            }
+
+            output[0] = pixel[0];
+            output[1] = pixel[1];
+            output[2] = pixel[2];
+            output += 3;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef SEAM_ORDER_H
+#define SEAM_ORDER_H
+
+#include <stddef.h>
+
+// A seam order map records, for every pixel of the original image, the index
+// of the seam that removed it. Pixels that were never removed are recorded as
+// `num_seams`. Given such a map, removing the first N seams doesn't require
+// any energy or seam computations: each row simply keeps the pixels whose
+// index is N or higher, which is always exactly N fewer pixels than the
+// original width.
+//
+// On disk, the map is stored as a 24-byte header followed by one entry per
+// pixel, in row-major order. Each entry uses the smallest number of bytes
+// that fits `num_seams`. All the integers are little-endian.
+//
+//   offset  size  contents
+//        0     4  "SCMP"
+//        4     4  version, currently 1
+//        8     4  width of the original image
+//       12     4  height of the original image
+//       16     4  number of seams recorded
+//       20     4  bytes per entry: 1, 2 or 4
+
+#define SEAM_ORDER_HEADER_SIZE 24
+
+struct seam_order_map {
+    int w;
+    int h;
+    int num_seams;
+    int bytes_per_entry;
+
+    // Points into the buffer the map was parsed from.
+    const unsigned char *entries;
+};
+
+unsigned int seam_order_at(const struct seam_order_map *map, int x, int y);
+
+// Writes a map from one entry per pixel, with UINT_MAX for pixels that were
+// never removed. Returns non-zero on error.
+int write_seam_order_map(
+        const char *filename,
+        const unsigned int *removal_order,
+        int w,
+        int h,
+        int num_seams);
+
+// Parses a map from the contents of a map file, without copying the entries.
+// Every row is checked to remove each seam exactly once, so a corrupted map
+// can't make `apply_seam_order_map` write past its output. Returns non-zero if
+// the contents are not a valid map.
+int parse_seam_order_map(
+        const unsigned char *contents,
+        size_t size,
+        struct seam_order_map *map);
+
+// Reads and parses a map file. Returns the buffer holding the file contents,
+// which must be freed once the map is no longer used, or NULL on error.
+unsigned char * load_seam_order_map(
+        const char *filename,
+        struct seam_order_map *map);
+
+// Removes the first `num_seams` seams from an RGB image matching the
+// dimensions of the map. `output` must have room for the resulting
+// (w - num_seams) x h image.
+void apply_seam_order_map(
+        const struct seam_order_map *map,
+        const unsigned char *data,
+        int num_seams,
+        unsigned char *output);
+
+#endif
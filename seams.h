@@ -0,0 +1,20 @@
+#ifndef SEAMS_H
+#define SEAMS_H
+
+// A vertical seam removes one pixel from each row of an image, and is stored
+// as the X coordinate of that pixel for each row, starting from the bottom
+// row: the pixel in row y is at seam[h - 1 - y]. A horizontal seam removes
+// one pixel from each column, and is stored as the Y coordinate of that pixel
+// for each column, starting from the rightmost column: the pixel in column x
+// is at seam[w - 1 - x]. Either way, this is the order in which the seam is
+// backtracked from its end.
+//
+// Multiple seams of the same direction are stored one after the other. They
+// never cross, and are sorted from left to right, or from top to bottom.
+
+enum seam_direction {
+    VERTICAL_SEAMS,
+    HORIZONTAL_SEAMS
+};
+
+#endif
@@ -0,0 +1,1081 @@
+#include <string.h>
+
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+// SCALAR /////////////////////////////////////////////////////////////////////
+
+static int energy_row_scalar(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row) {
+    (void) row_above;
+    (void) row;
+    (void) row_below;
+    (void) w;
+    (void) energy_row;
+
+    // Leave the entire row to the caller.
+    return 1;
+}
+
+static void seam_row_tail(
+        const unsigned int *prev_row,
+        const unsigned int *energy_row,
+        unsigned int *row,
+        signed char *parent_offsets,
+        int x,
+        int n) {
+    for (; x < n; x++) {
+        unsigned int l = prev_row[x - 1];
+        unsigned int c = prev_row[x];
+        unsigned int r = prev_row[x + 1];
+
+        // The comparisons mirror the vectorized kernels: find the minimum
+        // first, then pick the leftmost candidate equal to it.
+        unsigned int m = l < c ? l : c;
+        m = r < m ? r : m;
+
+        row[x] = energy_row[x] + m;
+        parent_offsets[x] = l == m ? -1 : c == m ? 0 : 1;
+    }
+}
+
+static void seam_row_scalar(
+        const unsigned int *prev_row,
+        const unsigned int *energy_row,
+        unsigned int *row,
+        signed char *parent_offsets,
+        int n) {
+    seam_row_tail(prev_row, energy_row, row, parent_offsets, 0, n);
+}
+
+static int forward_seam_row_scalar(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned int *prev_row,
+        int w,
+        int x,
+        int x1,
+        unsigned int *row_links,
+        signed char *parent_offsets) {
+    (void) row_above;
+    (void) row;
+    (void) prev_row;
+    (void) w;
+    (void) x1;
+    (void) row_links;
+    (void) parent_offsets;
+
+    // Leave the entire row to the caller.
+    return x;
+}
+
+#ifdef SIMD_X86
+
+// SSE4.1 /////////////////////////////////////////////////////////////////////
+
+// The energy of a pixel is the sum of the squared differences of each color
+// channel, between the left and right neighbors and between the top and bottom
+// neighbors. Because the image is stored as interleaved RGB, each group of 8
+// pixels (24 bytes) is loaded and shuffled into one vector per channel, with
+// each channel value widened to 16 bits. The squared differences are then
+// summed up in 32 bits by `madd`, which multiplies pairs of 16-bit values and
+// adds the two products together.
+//
+// Every intermediate value fits in its lane without overflow, so the result
+// is identical to the scalar computation.
+
+__attribute__((target("sse4.1")))
+static void load_rgb_sse41(
+        const unsigned char *p,
+        __m128i *r,
+        __m128i *g,
+        __m128i *b) {
+    const __m128i r_lo = _mm_setr_epi8(
+            0, -1, 3, -1, 6, -1, 9, -1, 12, -1, 15, -1, -1, -1, -1, -1);
+    const __m128i r_hi = _mm_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, -1, 5, -1);
+    const __m128i g_lo = _mm_setr_epi8(
+            1, -1, 4, -1, 7, -1, 10, -1, 13, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g_hi = _mm_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, -1, 3, -1, 6, -1);
+    const __m128i b_lo = _mm_setr_epi8(
+            2, -1, 5, -1, 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b_hi = _mm_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, -1, 4, -1, 7, -1);
+
+    __m128i lo = _mm_loadu_si128((const __m128i *) p);
+    __m128i hi = _mm_loadl_epi64((const __m128i *) (p + 16));
+
+    *r = _mm_or_si128(_mm_shuffle_epi8(lo, r_lo), _mm_shuffle_epi8(hi, r_hi));
+    *g = _mm_or_si128(_mm_shuffle_epi8(lo, g_lo), _mm_shuffle_epi8(hi, g_hi));
+    *b = _mm_or_si128(_mm_shuffle_epi8(lo, b_lo), _mm_shuffle_epi8(hi, b_hi));
+}
+
+__attribute__((target("sse4.1")))
+static int energy_row_sse41(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row) {
+    int x = 1;
+
+    // The right neighbor of the last pixel in a block must not be in the last
+    // column, since the last column has no right neighbor of its own.
+    for (; x + 8 < w; x += 8) {
+        __m128i lr, lg, lb, rr, rg, rb, ur, ug, ub, dr, dg, db;
+        load_rgb_sse41(row + (x - 1) * 3, &lr, &lg, &lb);
+        load_rgb_sse41(row + (x + 1) * 3, &rr, &rg, &rb);
+        load_rgb_sse41(row_above + x * 3, &ur, &ug, &ub);
+        load_rgb_sse41(row_below + x * 3, &dr, &dg, &db);
+
+        __m128i dxr = _mm_sub_epi16(lr, rr);
+        __m128i dxg = _mm_sub_epi16(lg, rg);
+        __m128i dxb = _mm_sub_epi16(lb, rb);
+        __m128i dyr = _mm_sub_epi16(ur, dr);
+        __m128i dyg = _mm_sub_epi16(ug, dg);
+        __m128i dyb = _mm_sub_epi16(ub, db);
+
+        __m128i t;
+        __m128i energy_lo, energy_hi;
+
+        t = _mm_unpacklo_epi16(dxr, dyr);
+        energy_lo = _mm_madd_epi16(t, t);
+        t = _mm_unpacklo_epi16(dxg, dyg);
+        energy_lo = _mm_add_epi32(energy_lo, _mm_madd_epi16(t, t));
+        t = _mm_unpacklo_epi16(dxb, dyb);
+        energy_lo = _mm_add_epi32(energy_lo, _mm_madd_epi16(t, t));
+
+        t = _mm_unpackhi_epi16(dxr, dyr);
+        energy_hi = _mm_madd_epi16(t, t);
+        t = _mm_unpackhi_epi16(dxg, dyg);
+        energy_hi = _mm_add_epi32(energy_hi, _mm_madd_epi16(t, t));
+        t = _mm_unpackhi_epi16(dxb, dyb);
+        energy_hi = _mm_add_epi32(energy_hi, _mm_madd_epi16(t, t));
+
+        _mm_storeu_si128((__m128i *) (energy_row + x), energy_lo);
+        _mm_storeu_si128((__m128i *) (energy_row + x + 4), energy_hi);
+    }
+
+    return x;
+}
+
+// On a brightness plane, each block is loaded with a single widening load per
+// neighbor, and a single `madd` sums both squared differences.
+
+__attribute__((target("sse4.1")))
+static int luma_energy_row_sse41(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row) {
+    int x = 1;
+
+    for (; x + 8 < w; x += 8) {
+        __m128i l = _mm_cvtepu8_epi16(
+                _mm_loadl_epi64((const __m128i *) (row + x - 1)));
+        __m128i r = _mm_cvtepu8_epi16(
+                _mm_loadl_epi64((const __m128i *) (row + x + 1)));
+        __m128i u = _mm_cvtepu8_epi16(
+                _mm_loadl_epi64((const __m128i *) (row_above + x)));
+        __m128i d = _mm_cvtepu8_epi16(
+                _mm_loadl_epi64((const __m128i *) (row_below + x)));
+
+        __m128i dx = _mm_sub_epi16(l, r);
+        __m128i dy = _mm_sub_epi16(u, d);
+
+        __m128i t = _mm_unpacklo_epi16(dx, dy);
+        _mm_storeu_si128((__m128i *) (energy_row + x), _mm_madd_epi16(t, t));
+        t = _mm_unpackhi_epi16(dx, dy);
+        _mm_storeu_si128(
+                (__m128i *) (energy_row + x + 4),
+                _mm_madd_epi16(t, t));
+    }
+
+    return x;
+}
+
+// Each cumulative energy only depends on the previous row, so a whole block of
+// the row is computed with unsigned minimums over three shifted loads of the
+// previous row. The parent offsets start out as +1, then are overwritten by 0
+// where the middle parent is minimal, then by -1 where the left parent is
+// minimal, which gives the same leftmost tie-breaking as the scalar code.
+
+__attribute__((target("sse4.1")))
+static __m128i seam_block_sse41(
+        const unsigned int *prev_row,
+        const unsigned int *energy_row,
+        unsigned int *row,
+        int x) {
+    __m128i l = _mm_loadu_si128((const __m128i *) (prev_row + x - 1));
+    __m128i c = _mm_loadu_si128((const __m128i *) (prev_row + x));
+    __m128i r = _mm_loadu_si128((const __m128i *) (prev_row + x + 1));
+    __m128i e = _mm_loadu_si128((const __m128i *) (energy_row + x));
+
+    __m128i m = _mm_min_epu32(_mm_min_epu32(l, c), r);
+    _mm_storeu_si128((__m128i *) (row + x), _mm_add_epi32(e, m));
+
+    __m128i offsets = _mm_set1_epi32(1);
+    offsets = _mm_blendv_epi8(
+            offsets,
+            _mm_setzero_si128(),
+            _mm_cmpeq_epi32(c, m));
+    offsets = _mm_blendv_epi8(
+            offsets,
+            _mm_set1_epi32(-1),
+            _mm_cmpeq_epi32(l, m));
+
+    return offsets;
+}
+
+__attribute__((target("sse4.1")))
+static void seam_row_sse41(
+        const unsigned int *prev_row,
+        const unsigned int *energy_row,
+        unsigned int *row,
+        signed char *parent_offsets,
+        int n) {
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8) {
+        __m128i offsets_lo = seam_block_sse41(prev_row, energy_row, row, x);
+        __m128i offsets_hi =
+            seam_block_sse41(prev_row, energy_row, row, x + 4);
+
+        // Narrow the 32-bit offsets down to 8 bits.
+        __m128i offsets = _mm_packs_epi32(offsets_lo, offsets_hi);
+        offsets = _mm_packs_epi16(offsets, offsets);
+        _mm_storel_epi64((__m128i *) (parent_offsets + x), offsets);
+    }
+
+    seam_row_tail(prev_row, energy_row, row, parent_offsets, x, n);
+}
+
+// The forward energy needs three separate distances per pixel, so the squared
+// differences of red and green are summed by one `madd`, and blue by another,
+// paired with zeros. Adding the distance between the left and right neighbors
+// to all three candidates doesn't change which one is minimal, so it is only
+// added once the minimum is found.
+
+__attribute__((target("sse4.1")))
+static void distance_sse41(
+        __m128i ar,
+        __m128i ag,
+        __m128i ab,
+        __m128i br,
+        __m128i bg,
+        __m128i bb,
+        __m128i *distance_lo,
+        __m128i *distance_hi) {
+    __m128i dr = _mm_sub_epi16(ar, br);
+    __m128i dg = _mm_sub_epi16(ag, bg);
+    __m128i db = _mm_sub_epi16(ab, bb);
+    __m128i t;
+
+    t = _mm_unpacklo_epi16(dr, dg);
+    *distance_lo = _mm_madd_epi16(t, t);
+    t = _mm_unpacklo_epi16(db, _mm_setzero_si128());
+    *distance_lo = _mm_add_epi32(*distance_lo, _mm_madd_epi16(t, t));
+
+    t = _mm_unpackhi_epi16(dr, dg);
+    *distance_hi = _mm_madd_epi16(t, t);
+    t = _mm_unpackhi_epi16(db, _mm_setzero_si128());
+    *distance_hi = _mm_add_epi32(*distance_hi, _mm_madd_epi16(t, t));
+}
+
+__attribute__((target("sse4.1")))
+static __m128i forward_seam_block_sse41(
+        const unsigned int *prev_row,
+        int x,
+        __m128i cost_up,
+        __m128i cost_left,
+        __m128i cost_right,
+        unsigned int *row_links) {
+    __m128i l = _mm_add_epi32(
+            _mm_loadu_si128((const __m128i *) (prev_row + x - 1)),
+            cost_left);
+    __m128i c = _mm_loadu_si128((const __m128i *) (prev_row + x));
+    __m128i r = _mm_add_epi32(
+            _mm_loadu_si128((const __m128i *) (prev_row + x + 1)),
+            cost_right);
+
+    __m128i m = _mm_min_epu32(_mm_min_epu32(l, c), r);
+    _mm_storeu_si128((__m128i *) row_links, _mm_add_epi32(cost_up, m));
+
+    __m128i offsets = _mm_set1_epi32(1);
+    offsets = _mm_blendv_epi8(
+            offsets,
+            _mm_setzero_si128(),
+            _mm_cmpeq_epi32(c, m));
+    offsets = _mm_blendv_epi8(
+            offsets,
+            _mm_set1_epi32(-1),
+            _mm_cmpeq_epi32(l, m));
+
+    return offsets;
+}
+
+__attribute__((target("sse4.1")))
+static int forward_seam_row_sse41(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned int *prev_row,
+        int w,
+        int x,
+        int x1,
+        unsigned int *row_links,
+        signed char *parent_offsets) {
+    int i = 0;
+
+    for (; x + 8 <= x1 && x + 8 < w; x += 8, i += 8) {
+        __m128i lr, lg, lb, rr, rg, rb, ar, ag, ab;
+        load_rgb_sse41(row + (x - 1) * 3, &lr, &lg, &lb);
+        load_rgb_sse41(row + (x + 1) * 3, &rr, &rg, &rb);
+        load_rgb_sse41(row_above + x * 3, &ar, &ag, &ab);
+
+        __m128i up_lo, up_hi, left_lo, left_hi, right_lo, right_hi;
+        distance_sse41(lr, lg, lb, rr, rg, rb, &up_lo, &up_hi);
+        distance_sse41(ar, ag, ab, lr, lg, lb, &left_lo, &left_hi);
+        distance_sse41(ar, ag, ab, rr, rg, rb, &right_lo, &right_hi);
+
+        __m128i offsets_lo = forward_seam_block_sse41(
+                prev_row,
+                x,
+                up_lo,
+                left_lo,
+                right_lo,
+                row_links + i);
+        __m128i offsets_hi = forward_seam_block_sse41(
+                prev_row,
+                x + 4,
+                up_hi,
+                left_hi,
+                right_hi,
+                row_links + i + 4);
+
+        __m128i offsets = _mm_packs_epi32(offsets_lo, offsets_hi);
+        offsets = _mm_packs_epi16(offsets, offsets);
+        _mm_storel_epi64((__m128i *) (parent_offsets + i), offsets);
+    }
+
+    return x;
+}
+
+// AVX2 ///////////////////////////////////////////////////////////////////////
+
+// Same as the SSE4.1 kernel, but with 16 pixels per block. The shuffles in
+// AVX2 operate within each 128-bit lane, so the first 8 pixels are loaded into
+// the lower lane and the next 8 pixels into the upper lane. This lets both
+// lanes reuse the SSE4.1 shuffle masks as-is.
+
+__attribute__((target("avx2")))
+static void load_rgb_avx2(
+        const unsigned char *p,
+        __m256i *r,
+        __m256i *g,
+        __m256i *b) {
+    const __m256i r_lo = _mm256_setr_epi8(
+            0, -1, 3, -1, 6, -1, 9, -1, 12, -1, 15, -1, -1, -1, -1, -1,
+            0, -1, 3, -1, 6, -1, 9, -1, 12, -1, 15, -1, -1, -1, -1, -1);
+    const __m256i r_hi = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, -1, 5, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, -1, 5, -1);
+    const __m256i g_lo = _mm256_setr_epi8(
+            1, -1, 4, -1, 7, -1, 10, -1, 13, -1, -1, -1, -1, -1, -1, -1,
+            1, -1, 4, -1, 7, -1, 10, -1, 13, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i g_hi = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, -1, 3, -1, 6, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, -1, 3, -1, 6, -1);
+    const __m256i b_lo = _mm256_setr_epi8(
+            2, -1, 5, -1, 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1,
+            2, -1, 5, -1, 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i b_hi = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, -1, 4, -1, 7, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, -1, 4, -1, 7, -1);
+
+    __m256i lo = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) p)),
+            _mm_loadu_si128((const __m128i *) (p + 24)),
+            1);
+    __m256i hi = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_loadl_epi64((const __m128i *) (p + 16))),
+            _mm_loadl_epi64((const __m128i *) (p + 40)),
+            1);
+
+    *r = _mm256_or_si256(
+            _mm256_shuffle_epi8(lo, r_lo),
+            _mm256_shuffle_epi8(hi, r_hi));
+    *g = _mm256_or_si256(
+            _mm256_shuffle_epi8(lo, g_lo),
+            _mm256_shuffle_epi8(hi, g_hi));
+    *b = _mm256_or_si256(
+            _mm256_shuffle_epi8(lo, b_lo),
+            _mm256_shuffle_epi8(hi, b_hi));
+}
+
+__attribute__((target("avx2")))
+static int energy_row_avx2(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row) {
+    int x = 1;
+
+    for (; x + 16 < w; x += 16) {
+        __m256i lr, lg, lb, rr, rg, rb, ur, ug, ub, dr, dg, db;
+        load_rgb_avx2(row + (x - 1) * 3, &lr, &lg, &lb);
+        load_rgb_avx2(row + (x + 1) * 3, &rr, &rg, &rb);
+        load_rgb_avx2(row_above + x * 3, &ur, &ug, &ub);
+        load_rgb_avx2(row_below + x * 3, &dr, &dg, &db);
+
+        __m256i dxr = _mm256_sub_epi16(lr, rr);
+        __m256i dxg = _mm256_sub_epi16(lg, rg);
+        __m256i dxb = _mm256_sub_epi16(lb, rb);
+        __m256i dyr = _mm256_sub_epi16(ur, dr);
+        __m256i dyg = _mm256_sub_epi16(ug, dg);
+        __m256i dyb = _mm256_sub_epi16(ub, db);
+
+        __m256i t;
+        __m256i energy_lo, energy_hi;
+
+        // Lower lane: pixels 0-3, upper lane: pixels 8-11.
+        t = _mm256_unpacklo_epi16(dxr, dyr);
+        energy_lo = _mm256_madd_epi16(t, t);
+        t = _mm256_unpacklo_epi16(dxg, dyg);
+        energy_lo = _mm256_add_epi32(energy_lo, _mm256_madd_epi16(t, t));
+        t = _mm256_unpacklo_epi16(dxb, dyb);
+        energy_lo = _mm256_add_epi32(energy_lo, _mm256_madd_epi16(t, t));
+
+        // Lower lane: pixels 4-7, upper lane: pixels 12-15.
+        t = _mm256_unpackhi_epi16(dxr, dyr);
+        energy_hi = _mm256_madd_epi16(t, t);
+        t = _mm256_unpackhi_epi16(dxg, dyg);
+        energy_hi = _mm256_add_epi32(energy_hi, _mm256_madd_epi16(t, t));
+        t = _mm256_unpackhi_epi16(dxb, dyb);
+        energy_hi = _mm256_add_epi32(energy_hi, _mm256_madd_epi16(t, t));
+
+        _mm256_storeu_si256(
+                (__m256i *) (energy_row + x),
+                _mm256_permute2x128_si256(energy_lo, energy_hi, 0x20));
+        _mm256_storeu_si256(
+                (__m256i *) (energy_row + x + 8),
+                _mm256_permute2x128_si256(energy_lo, energy_hi, 0x31));
+    }
+
+    return x;
+}
+
+// The widening load keeps the pixels in order across both lanes, so the
+// results are interleaved back the same way as for the RGB image.
+
+__attribute__((target("avx2")))
+static int luma_energy_row_avx2(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row) {
+    int x = 1;
+
+    for (; x + 16 < w; x += 16) {
+        __m256i l = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i *) (row + x - 1)));
+        __m256i r = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i *) (row + x + 1)));
+        __m256i u = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i *) (row_above + x)));
+        __m256i d = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i *) (row_below + x)));
+
+        __m256i dx = _mm256_sub_epi16(l, r);
+        __m256i dy = _mm256_sub_epi16(u, d);
+
+        __m256i t = _mm256_unpacklo_epi16(dx, dy);
+        __m256i energy_lo = _mm256_madd_epi16(t, t);
+        t = _mm256_unpackhi_epi16(dx, dy);
+        __m256i energy_hi = _mm256_madd_epi16(t, t);
+
+        _mm256_storeu_si256(
+                (__m256i *) (energy_row + x),
+                _mm256_permute2x128_si256(energy_lo, energy_hi, 0x20));
+        _mm256_storeu_si256(
+                (__m256i *) (energy_row + x + 8),
+                _mm256_permute2x128_si256(energy_lo, energy_hi, 0x31));
+    }
+
+    return x;
+}
+
+__attribute__((target("avx2")))
+static void seam_row_avx2(
+        const unsigned int *prev_row,
+        const unsigned int *energy_row,
+        unsigned int *row,
+        signed char *parent_offsets,
+        int n) {
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8) {
+        __m256i l = _mm256_loadu_si256((const __m256i *) (prev_row + x - 1));
+        __m256i c = _mm256_loadu_si256((const __m256i *) (prev_row + x));
+        __m256i r = _mm256_loadu_si256((const __m256i *) (prev_row + x + 1));
+        __m256i e = _mm256_loadu_si256((const __m256i *) (energy_row + x));
+
+        __m256i m = _mm256_min_epu32(_mm256_min_epu32(l, c), r);
+        _mm256_storeu_si256((__m256i *) (row + x), _mm256_add_epi32(e, m));
+
+        __m256i offsets = _mm256_set1_epi32(1);
+        offsets = _mm256_blendv_epi8(
+                offsets,
+                _mm256_setzero_si256(),
+                _mm256_cmpeq_epi32(c, m));
+        offsets = _mm256_blendv_epi8(
+                offsets,
+                _mm256_set1_epi32(-1),
+                _mm256_cmpeq_epi32(l, m));
+
+        // The packs operate within each 128-bit lane, leaving offsets 0-3 in
+        // the first 32 bits of the lower lane and 4-7 in the first 32 bits of
+        // the upper lane.
+        offsets = _mm256_packs_epi32(offsets, offsets);
+        offsets = _mm256_packs_epi16(offsets, offsets);
+        offsets = _mm256_permutevar8x32_epi32(
+                offsets,
+                _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+        _mm_storel_epi64(
+                (__m128i *) (parent_offsets + x),
+                _mm256_castsi256_si128(offsets));
+    }
+
+    seam_row_tail(prev_row, energy_row, row, parent_offsets, x, n);
+}
+
+// The distances come out with pixels 0-3 and 8-11 in one vector and pixels
+// 4-7 and 12-15 in the other, so they are put back in pixel order before
+// being added to the previous row.
+
+__attribute__((target("avx2")))
+static void distance_avx2(
+        __m256i ar,
+        __m256i ag,
+        __m256i ab,
+        __m256i br,
+        __m256i bg,
+        __m256i bb,
+        __m256i *distance_lo,
+        __m256i *distance_hi) {
+    __m256i dr = _mm256_sub_epi16(ar, br);
+    __m256i dg = _mm256_sub_epi16(ag, bg);
+    __m256i db = _mm256_sub_epi16(ab, bb);
+    __m256i t, lo, hi;
+
+    t = _mm256_unpacklo_epi16(dr, dg);
+    lo = _mm256_madd_epi16(t, t);
+    t = _mm256_unpacklo_epi16(db, _mm256_setzero_si256());
+    lo = _mm256_add_epi32(lo, _mm256_madd_epi16(t, t));
+
+    t = _mm256_unpackhi_epi16(dr, dg);
+    hi = _mm256_madd_epi16(t, t);
+    t = _mm256_unpackhi_epi16(db, _mm256_setzero_si256());
+    hi = _mm256_add_epi32(hi, _mm256_madd_epi16(t, t));
+
+    *distance_lo = _mm256_permute2x128_si256(lo, hi, 0x20);
+    *distance_hi = _mm256_permute2x128_si256(lo, hi, 0x31);
+}
+
+__attribute__((target("avx2")))
+static void forward_seam_block_avx2(
+        const unsigned int *prev_row,
+        int x,
+        __m256i cost_up,
+        __m256i cost_left,
+        __m256i cost_right,
+        unsigned int *row_links,
+        signed char *parent_offsets) {
+    __m256i l = _mm256_add_epi32(
+            _mm256_loadu_si256((const __m256i *) (prev_row + x - 1)),
+            cost_left);
+    __m256i c = _mm256_loadu_si256((const __m256i *) (prev_row + x));
+    __m256i r = _mm256_add_epi32(
+            _mm256_loadu_si256((const __m256i *) (prev_row + x + 1)),
+            cost_right);
+
+    __m256i m = _mm256_min_epu32(_mm256_min_epu32(l, c), r);
+    _mm256_storeu_si256((__m256i *) row_links, _mm256_add_epi32(cost_up, m));
+
+    __m256i offsets = _mm256_set1_epi32(1);
+    offsets = _mm256_blendv_epi8(
+            offsets,
+            _mm256_setzero_si256(),
+            _mm256_cmpeq_epi32(c, m));
+    offsets = _mm256_blendv_epi8(
+            offsets,
+            _mm256_set1_epi32(-1),
+            _mm256_cmpeq_epi32(l, m));
+
+    offsets = _mm256_packs_epi32(offsets, offsets);
+    offsets = _mm256_packs_epi16(offsets, offsets);
+    offsets = _mm256_permutevar8x32_epi32(
+            offsets,
+            _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+    _mm_storel_epi64(
+            (__m128i *) parent_offsets,
+            _mm256_castsi256_si128(offsets));
+}
+
+__attribute__((target("avx2")))
+static int forward_seam_row_avx2(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned int *prev_row,
+        int w,
+        int x,
+        int x1,
+        unsigned int *row_links,
+        signed char *parent_offsets) {
+    int i = 0;
+
+    for (; x + 16 <= x1 && x + 16 < w; x += 16, i += 16) {
+        __m256i lr, lg, lb, rr, rg, rb, ar, ag, ab;
+        load_rgb_avx2(row + (x - 1) * 3, &lr, &lg, &lb);
+        load_rgb_avx2(row + (x + 1) * 3, &rr, &rg, &rb);
+        load_rgb_avx2(row_above + x * 3, &ar, &ag, &ab);
+
+        __m256i up_lo, up_hi, left_lo, left_hi, right_lo, right_hi;
+        distance_avx2(lr, lg, lb, rr, rg, rb, &up_lo, &up_hi);
+        distance_avx2(ar, ag, ab, lr, lg, lb, &left_lo, &left_hi);
+        distance_avx2(ar, ag, ab, rr, rg, rb, &right_lo, &right_hi);
+
+        forward_seam_block_avx2(
+                prev_row,
+                x,
+                up_lo,
+                left_lo,
+                right_lo,
+                row_links + i,
+                parent_offsets + i);
+        forward_seam_block_avx2(
+                prev_row,
+                x + 8,
+                up_hi,
+                left_hi,
+                right_hi,
+                row_links + i + 8,
+                parent_offsets + i + 8);
+    }
+
+    return x;
+}
+
+// AVX-512 ////////////////////////////////////////////////////////////////////
+
+// Same as the AVX2 kernel, but with 32 pixels per block, 8 in each of the four
+// 128-bit lanes.
+
+__attribute__((target("avx512f,avx512bw")))
+static void load_rgb_avx512(
+        const unsigned char *p,
+        __m512i *r,
+        __m512i *g,
+        __m512i *b) {
+    const __m512i r_lo = _mm512_broadcast_i32x4(_mm_setr_epi8(
+            0, -1, 3, -1, 6, -1, 9, -1, 12, -1, 15, -1, -1, -1, -1, -1));
+    const __m512i r_hi = _mm512_broadcast_i32x4(_mm_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, -1, 5, -1));
+    const __m512i g_lo = _mm512_broadcast_i32x4(_mm_setr_epi8(
+            1, -1, 4, -1, 7, -1, 10, -1, 13, -1, -1, -1, -1, -1, -1, -1));
+    const __m512i g_hi = _mm512_broadcast_i32x4(_mm_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, -1, 3, -1, 6, -1));
+    const __m512i b_lo = _mm512_broadcast_i32x4(_mm_setr_epi8(
+            2, -1, 5, -1, 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1));
+    const __m512i b_hi = _mm512_broadcast_i32x4(_mm_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, -1, 4, -1, 7, -1));
+
+    __m512i lo = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *) p));
+    lo = _mm512_inserti32x4(lo, _mm_loadu_si128((const __m128i *) (p + 24)), 1);
+    lo = _mm512_inserti32x4(lo, _mm_loadu_si128((const __m128i *) (p + 48)), 2);
+    lo = _mm512_inserti32x4(lo, _mm_loadu_si128((const __m128i *) (p + 72)), 3);
+
+    __m512i hi =
+        _mm512_castsi128_si512(_mm_loadl_epi64((const __m128i *) (p + 16)));
+    hi = _mm512_inserti32x4(hi, _mm_loadl_epi64((const __m128i *) (p + 40)), 1);
+    hi = _mm512_inserti32x4(hi, _mm_loadl_epi64((const __m128i *) (p + 64)), 2);
+    hi = _mm512_inserti32x4(hi, _mm_loadl_epi64((const __m128i *) (p + 88)), 3);
+
+    *r = _mm512_or_si512(
+            _mm512_shuffle_epi8(lo, r_lo),
+            _mm512_shuffle_epi8(hi, r_hi));
+    *g = _mm512_or_si512(
+            _mm512_shuffle_epi8(lo, g_lo),
+            _mm512_shuffle_epi8(hi, g_hi));
+    *b = _mm512_or_si512(
+            _mm512_shuffle_epi8(lo, b_lo),
+            _mm512_shuffle_epi8(hi, b_hi));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int energy_row_avx512(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row) {
+    // Interleave the 128-bit lanes of the low and high halves back into pixel
+    // order. Each index selects a 64-bit element, with 8-15 selecting from the
+    // second operand.
+    const __m512i first_half = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+    const __m512i second_half = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+
+    int x = 1;
+
+    for (; x + 32 < w; x += 32) {
+        __m512i lr, lg, lb, rr, rg, rb, ur, ug, ub, dr, dg, db;
+        load_rgb_avx512(row + (x - 1) * 3, &lr, &lg, &lb);
+        load_rgb_avx512(row + (x + 1) * 3, &rr, &rg, &rb);
+        load_rgb_avx512(row_above + x * 3, &ur, &ug, &ub);
+        load_rgb_avx512(row_below + x * 3, &dr, &dg, &db);
+
+        __m512i dxr = _mm512_sub_epi16(lr, rr);
+        __m512i dxg = _mm512_sub_epi16(lg, rg);
+        __m512i dxb = _mm512_sub_epi16(lb, rb);
+        __m512i dyr = _mm512_sub_epi16(ur, dr);
+        __m512i dyg = _mm512_sub_epi16(ug, dg);
+        __m512i dyb = _mm512_sub_epi16(ub, db);
+
+        __m512i t;
+        __m512i energy_lo, energy_hi;
+
+        t = _mm512_unpacklo_epi16(dxr, dyr);
+        energy_lo = _mm512_madd_epi16(t, t);
+        t = _mm512_unpacklo_epi16(dxg, dyg);
+        energy_lo = _mm512_add_epi32(energy_lo, _mm512_madd_epi16(t, t));
+        t = _mm512_unpacklo_epi16(dxb, dyb);
+        energy_lo = _mm512_add_epi32(energy_lo, _mm512_madd_epi16(t, t));
+
+        t = _mm512_unpackhi_epi16(dxr, dyr);
+        energy_hi = _mm512_madd_epi16(t, t);
+        t = _mm512_unpackhi_epi16(dxg, dyg);
+        energy_hi = _mm512_add_epi32(energy_hi, _mm512_madd_epi16(t, t));
+        t = _mm512_unpackhi_epi16(dxb, dyb);
+        energy_hi = _mm512_add_epi32(energy_hi, _mm512_madd_epi16(t, t));
+
+        _mm512_storeu_si512(
+                energy_row + x,
+                _mm512_permutex2var_epi64(energy_lo, first_half, energy_hi));
+        _mm512_storeu_si512(
+                energy_row + x + 16,
+                _mm512_permutex2var_epi64(energy_lo, second_half, energy_hi));
+    }
+
+    return x;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int luma_energy_row_avx512(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row) {
+    const __m512i first_half = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+    const __m512i second_half = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+
+    int x = 1;
+
+    for (; x + 32 < w; x += 32) {
+        __m512i l = _mm512_cvtepu8_epi16(
+                _mm256_loadu_si256((const __m256i *) (row + x - 1)));
+        __m512i r = _mm512_cvtepu8_epi16(
+                _mm256_loadu_si256((const __m256i *) (row + x + 1)));
+        __m512i u = _mm512_cvtepu8_epi16(
+                _mm256_loadu_si256((const __m256i *) (row_above + x)));
+        __m512i d = _mm512_cvtepu8_epi16(
+                _mm256_loadu_si256((const __m256i *) (row_below + x)));
+
+        __m512i dx = _mm512_sub_epi16(l, r);
+        __m512i dy = _mm512_sub_epi16(u, d);
+
+        __m512i t = _mm512_unpacklo_epi16(dx, dy);
+        __m512i energy_lo = _mm512_madd_epi16(t, t);
+        t = _mm512_unpackhi_epi16(dx, dy);
+        __m512i energy_hi = _mm512_madd_epi16(t, t);
+
+        _mm512_storeu_si512(
+                energy_row + x,
+                _mm512_permutex2var_epi64(energy_lo, first_half, energy_hi));
+        _mm512_storeu_si512(
+                energy_row + x + 16,
+                _mm512_permutex2var_epi64(energy_lo, second_half, energy_hi));
+    }
+
+    return x;
+}
+
+// With AVX-512, the comparisons produce bit masks, which select the parent
+// offsets directly, and the offsets can be narrowed in a single instruction.
+
+__attribute__((target("avx512f")))
+static void seam_row_avx512(
+        const unsigned int *prev_row,
+        const unsigned int *energy_row,
+        unsigned int *row,
+        signed char *parent_offsets,
+        int n) {
+    int x = 0;
+
+    for (; x + 16 <= n; x += 16) {
+        __m512i l = _mm512_loadu_si512(prev_row + x - 1);
+        __m512i c = _mm512_loadu_si512(prev_row + x);
+        __m512i r = _mm512_loadu_si512(prev_row + x + 1);
+        __m512i e = _mm512_loadu_si512(energy_row + x);
+
+        __m512i m = _mm512_min_epu32(_mm512_min_epu32(l, c), r);
+        _mm512_storeu_si512(row + x, _mm512_add_epi32(e, m));
+
+        __m512i offsets = _mm512_set1_epi32(1);
+        offsets = _mm512_mask_mov_epi32(
+                offsets,
+                _mm512_cmpeq_epu32_mask(c, m),
+                _mm512_setzero_si512());
+        offsets = _mm512_mask_mov_epi32(
+                offsets,
+                _mm512_cmpeq_epu32_mask(l, m),
+                _mm512_set1_epi32(-1));
+
+        _mm_storeu_si128(
+                (__m128i *) (parent_offsets + x),
+                _mm512_cvtepi32_epi8(offsets));
+    }
+
+    seam_row_tail(prev_row, energy_row, row, parent_offsets, x, n);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void distance_avx512(
+        __m512i ar,
+        __m512i ag,
+        __m512i ab,
+        __m512i br,
+        __m512i bg,
+        __m512i bb,
+        __m512i *distance_lo,
+        __m512i *distance_hi) {
+    const __m512i first_half = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+    const __m512i second_half = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+
+    __m512i dr = _mm512_sub_epi16(ar, br);
+    __m512i dg = _mm512_sub_epi16(ag, bg);
+    __m512i db = _mm512_sub_epi16(ab, bb);
+    __m512i t, lo, hi;
+
+    t = _mm512_unpacklo_epi16(dr, dg);
+    lo = _mm512_madd_epi16(t, t);
+    t = _mm512_unpacklo_epi16(db, _mm512_setzero_si512());
+    lo = _mm512_add_epi32(lo, _mm512_madd_epi16(t, t));
+
+    t = _mm512_unpackhi_epi16(dr, dg);
+    hi = _mm512_madd_epi16(t, t);
+    t = _mm512_unpackhi_epi16(db, _mm512_setzero_si512());
+    hi = _mm512_add_epi32(hi, _mm512_madd_epi16(t, t));
+
+    *distance_lo = _mm512_permutex2var_epi64(lo, first_half, hi);
+    *distance_hi = _mm512_permutex2var_epi64(lo, second_half, hi);
+}
+
+__attribute__((target("avx512f")))
+static void forward_seam_block_avx512(
+        const unsigned int *prev_row,
+        int x,
+        __m512i cost_up,
+        __m512i cost_left,
+        __m512i cost_right,
+        unsigned int *row_links,
+        signed char *parent_offsets) {
+    __m512i l = _mm512_add_epi32(
+            _mm512_loadu_si512(prev_row + x - 1),
+            cost_left);
+    __m512i c = _mm512_loadu_si512(prev_row + x);
+    __m512i r = _mm512_add_epi32(
+            _mm512_loadu_si512(prev_row + x + 1),
+            cost_right);
+
+    __m512i m = _mm512_min_epu32(_mm512_min_epu32(l, c), r);
+    _mm512_storeu_si512(row_links, _mm512_add_epi32(cost_up, m));
+
+    __m512i offsets = _mm512_set1_epi32(1);
+    offsets = _mm512_mask_mov_epi32(
+            offsets,
+            _mm512_cmpeq_epu32_mask(c, m),
+            _mm512_setzero_si512());
+    offsets = _mm512_mask_mov_epi32(
+            offsets,
+            _mm512_cmpeq_epu32_mask(l, m),
+            _mm512_set1_epi32(-1));
+
+    _mm_storeu_si128(
+            (__m128i *) parent_offsets,
+            _mm512_cvtepi32_epi8(offsets));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int forward_seam_row_avx512(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned int *prev_row,
+        int w,
+        int x,
+        int x1,
+        unsigned int *row_links,
+        signed char *parent_offsets) {
+    int i = 0;
+
+    for (; x + 32 <= x1 && x + 32 < w; x += 32, i += 32) {
+        __m512i lr, lg, lb, rr, rg, rb, ar, ag, ab;
+        load_rgb_avx512(row + (x - 1) * 3, &lr, &lg, &lb);
+        load_rgb_avx512(row + (x + 1) * 3, &rr, &rg, &rb);
+        load_rgb_avx512(row_above + x * 3, &ar, &ag, &ab);
+
+        __m512i up_lo, up_hi, left_lo, left_hi, right_lo, right_hi;
+        distance_avx512(lr, lg, lb, rr, rg, rb, &up_lo, &up_hi);
+        distance_avx512(ar, ag, ab, lr, lg, lb, &left_lo, &left_hi);
+        distance_avx512(ar, ag, ab, rr, rg, rb, &right_lo, &right_hi);
+
+        forward_seam_block_avx512(
+                prev_row,
+                x,
+                up_lo,
+                left_lo,
+                right_lo,
+                row_links + i,
+                parent_offsets + i);
+        forward_seam_block_avx512(
+                prev_row,
+                x + 16,
+                up_hi,
+                left_hi,
+                right_hi,
+                row_links + i + 16,
+                parent_offsets + i + 16);
+    }
+
+    return x;
+}
+
+#endif
+
+// DISPATCH ///////////////////////////////////////////////////////////////////
+
+int (*simd_energy_row)(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row) = energy_row_scalar;
+
+int (*simd_luma_energy_row)(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row) = energy_row_scalar;
+
+void (*simd_seam_row)(
+        const unsigned int *prev_row,
+        const unsigned int *energy_row,
+        unsigned int *row,
+        signed char *parent_offsets,
+        int n) = seam_row_scalar;
+
+int (*simd_forward_seam_row)(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned int *prev_row,
+        int w,
+        int x,
+        int x1,
+        unsigned int *row_links,
+        signed char *parent_offsets) = forward_seam_row_scalar;
+
+static const char *level_names[] = {
+    [SIMD_SCALAR] = "scalar",
+    [SIMD_SSE41] = "sse4.1",
+    [SIMD_AVX2] = "avx2",
+    [SIMD_AVX512] = "avx512"
+};
+
+enum simd_level simd_detect(void) {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") &&
+            __builtin_cpu_supports("avx512bw")) {
+        return SIMD_AVX512;
+    }
+
+    if (__builtin_cpu_supports("avx2")) { return SIMD_AVX2; }
+    if (__builtin_cpu_supports("sse4.1")) { return SIMD_SSE41; }
+#endif
+
+    return SIMD_SCALAR;
+}
+
+int simd_select(enum simd_level level) {
+    if (level > simd_detect()) { return 1; }
+
+    switch (level) {
+#ifdef SIMD_X86
+        case SIMD_SSE41:
+            simd_energy_row = energy_row_sse41;
+            simd_luma_energy_row = luma_energy_row_sse41;
+            simd_seam_row = seam_row_sse41;
+            simd_forward_seam_row = forward_seam_row_sse41;
+            break;
+        case SIMD_AVX2:
+            simd_energy_row = energy_row_avx2;
+            simd_luma_energy_row = luma_energy_row_avx2;
+            simd_seam_row = seam_row_avx2;
+            simd_forward_seam_row = forward_seam_row_avx2;
+            break;
+        case SIMD_AVX512:
+            simd_energy_row = energy_row_avx512;
+            simd_luma_energy_row = luma_energy_row_avx512;
+            simd_seam_row = seam_row_avx512;
+            simd_forward_seam_row = forward_seam_row_avx512;
+            break;
+#endif
+        default:
+            simd_energy_row = energy_row_scalar;
+            simd_luma_energy_row = energy_row_scalar;
+            simd_seam_row = seam_row_scalar;
+            simd_forward_seam_row = forward_seam_row_scalar;
+            break;
+    }
+
+    return 0;
+}
+
+const char * simd_level_name(enum simd_level level) {
+    return level_names[level];
+}
+
+int simd_parse_level(const char *name, enum simd_level *level) {
+    for (int i = SIMD_SCALAR; i <= SIMD_AVX512; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            *level = i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
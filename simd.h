@@ -0,0 +1,95 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Vectorized kernels for the hot loops of the seam carver, along with the
+// runtime CPU detection used to pick the widest instruction set available.
+//
+// The kernels only handle the parts of the computation that map cleanly onto
+// vector instructions, like the interior of each row. The caller is
+// responsible for the remainder using the scalar code, which keeps the output
+// bit-identical regardless of which instruction set is used.
+
+enum simd_level {
+    SIMD_SCALAR,
+    SIMD_SSE41,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+// Returns the widest instruction set supported by the current CPU.
+enum simd_level simd_detect(void);
+
+// Selects the kernels for the given instruction set. Returns non-zero if the
+// current CPU does not support that instruction set.
+int simd_select(enum simd_level level);
+
+const char * simd_level_name(enum simd_level level);
+
+// Parses an instruction set name as printed by `simd_level_name`. Returns
+// non-zero if the name is not recognized.
+int simd_parse_level(const char *name, enum simd_level *level);
+
+// Computes the energy of the pixels in one row of an RGB image, starting at
+// x = 1 and stopping before reaching the last column. `row_above` and
+// `row_below` are the neighboring rows, or `row` itself at the top and bottom
+// of the image.
+//
+// Returns the first column whose energy was not computed, which is always at
+// least 1. The caller computes the energy of the first column and of the
+// remaining columns.
+extern int (*simd_energy_row)(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row);
+
+// The same as `simd_energy_row`, on a plane of brightness values with one
+// byte per pixel: the energy is the squared difference between the left and
+// right neighbors plus the squared difference between the top and bottom
+// neighbors.
+extern int (*simd_luma_energy_row)(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned char *row_below,
+        int w,
+        unsigned int *energy_row);
+
+// Computes one row of the cumulative energies used to find vertical seams.
+// For each x in [0, n), the parent is the neighbor with the lowest cumulative
+// energy among `prev_row[x - 1]`, `prev_row[x]` and `prev_row[x + 1]`, with
+// ties going to the leftmost candidate. The chosen parent is written to
+// `parent_offsets` as -1, 0 or +1.
+//
+// `prev_row[-1]` and `prev_row[n]` are always read, so the caller pads each row
+// with a sentinel column of UINT_MAX on both sides instead of branching on the
+// image borders.
+extern void (*simd_seam_row)(
+        const unsigned int *prev_row,
+        const unsigned int *energy_row,
+        unsigned int *row,
+        signed char *parent_offsets,
+        int n);
+
+// Computes one row of the cumulative forward energies used to find vertical
+// seams, straight from the pixels of `row` and `row_above`, starting at
+// column `x` and stopping before reaching `x1` or the last column. Removing a
+// pixel costs the squared color distance between its left and right
+// neighbors, plus the distance between the pixel above and the left or right
+// neighbor when the parent is the upper left or upper right one. Ties go to
+// the leftmost candidate, as in `simd_seam_row`.
+//
+// `x` must be at least 1. The results for column `x + i` are written to
+// `row_links[i]` and `parent_offsets[i]`. Returns the first column that was
+// not computed, which the caller finishes along with the first column.
+extern int (*simd_forward_seam_row)(
+        const unsigned char *row_above,
+        const unsigned char *row,
+        const unsigned int *prev_row,
+        int w,
+        int x,
+        int x1,
+        unsigned int *row_links,
+        signed char *parent_offsets);
+
+#endif
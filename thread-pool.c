@@ -0,0 +1,289 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread-pool.h"
+
+struct parallel_loop {
+    void (*task)(void *context, int index);
+    void *context;
+    int num_tasks;
+
+    // Tasks are claimed by incrementing `next_task`, so the threads balance
+    // the load between themselves without going through a mutex.
+    atomic_int next_task;
+
+    // The number of tasks not yet finished. The loop lives on the stack of
+    // the thread that started it, which only returns once this reaches 0, so
+    // a thread may only touch the loop while it holds an unfinished task.
+    atomic_int num_unfinished;
+
+    // 0 for loops started outside of any task, otherwise one more than the
+    // depth of the loop whose task started this one.
+    int depth;
+
+    // The next older loop started by the same thread and still running.
+    struct parallel_loop *older;
+};
+
+// Each thread keeps the loops it started, newest first, for the other
+// threads to steal tasks from. A thread always finishes its newest loop
+// first, while the other threads steal from its oldest loops, whose tasks
+// tend to be the largest.
+struct thread_slot {
+    struct thread_pool *pool;
+
+    // Guards `loops`, and the claiming of tasks by other threads, so that a
+    // loop is never touched once it's been removed.
+    pthread_mutex_t mutex;
+    struct parallel_loop *loops;
+
+    pthread_t thread;
+};
+
+struct thread_pool {
+    // The calling thread uses the first slot, and each worker the next ones.
+    struct thread_slot *slots;
+    int num_slots;
+    int num_workers;
+
+    // Guards `events` and `shutting_down`.
+    pthread_mutex_t mutex;
+
+    // Bumped and signaled whenever a loop starts or finishes, so threads with
+    // nothing to do can sleep until something changes.
+    pthread_cond_t changed;
+    unsigned long events;
+
+    int shutting_down;
+};
+
+// The slot of the current thread, if it's a worker, and the depth of the
+// task it's running.
+static _Thread_local struct thread_slot *current_slot;
+static _Thread_local int current_depth;
+
+static struct thread_slot * slot_of_current_thread(struct thread_pool *pool) {
+    if (current_slot && current_slot->pool == pool) { return current_slot; }
+    return &pool->slots[0];
+}
+
+static void signal_change(struct thread_pool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->events++;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static unsigned long current_events(struct thread_pool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    unsigned long events = pool->events;
+    pthread_mutex_unlock(&pool->mutex);
+
+    return events;
+}
+
+static void run_claimed_tasks(
+        struct thread_pool *pool,
+        struct parallel_loop *loop,
+        int index) {
+    // Runs the claimed task, then keeps claiming more until there are none
+    // left. The next task is claimed before finishing the current one, so
+    // the loop can't end in between.
+    int num_tasks = loop->num_tasks;
+    int depth = current_depth;
+    current_depth = loop->depth + 1;
+
+    while (index < num_tasks) {
+        loop->task(loop->context, index);
+
+        int next_index = atomic_fetch_add(&loop->next_task, 1);
+        if (atomic_fetch_sub(&loop->num_unfinished, 1) == 1) {
+            signal_change(pool);
+        }
+        index = next_index;
+    }
+
+    current_depth = depth;
+}
+
+static int steal_tasks(struct thread_pool *pool, int min_depth) {
+    // Looks for the oldest loop of another thread with tasks left, starting
+    // with the thread after this one so the thieves spread out. Returns
+    // non-zero if any task was run.
+    struct thread_slot *self = slot_of_current_thread(pool);
+    int start = self - pool->slots;
+
+    for (int i = 1; i <= pool->num_slots; i++) {
+        struct thread_slot *victim =
+            &pool->slots[(start + i) % pool->num_slots];
+
+        pthread_mutex_lock(&victim->mutex);
+        struct parallel_loop *oldest = NULL;
+        for (struct parallel_loop *loop = victim->loops;
+                loop;
+                loop = loop->older) {
+            if (loop->depth >= min_depth &&
+                    atomic_load(&loop->next_task) < loop->num_tasks) {
+                oldest = loop;
+            }
+        }
+
+        // The claim only holds if it's for an actual task, otherwise the loop
+        // may end as soon as the mutex is released.
+        int claimed = 0;
+        int index = 0;
+        if (oldest) {
+            index = atomic_fetch_add(&oldest->next_task, 1);
+            claimed = index < oldest->num_tasks;
+        }
+        pthread_mutex_unlock(&victim->mutex);
+
+        if (claimed) {
+            run_claimed_tasks(pool, oldest, index);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void * run_worker_thread(void *context) {
+    struct thread_slot *slot = context;
+    struct thread_pool *pool = slot->pool;
+    current_slot = slot;
+
+    for (;;) {
+        // The events are read before looking for work, so a loop starting
+        // in the meantime is never missed.
+        unsigned long events = current_events(pool);
+        if (steal_tasks(pool, 0)) { continue; }
+
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->events == events && !pool->shutting_down) {
+            pthread_cond_wait(&pool->changed, &pool->mutex);
+        }
+        int shutting_down = pool->shutting_down;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (shutting_down) { break; }
+    }
+
+    return NULL;
+}
+
+struct thread_pool * thread_pool_create(int num_threads) {
+    struct thread_pool *pool = calloc(1, sizeof(struct thread_pool));
+    if (!pool) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+
+    int num_slots = num_threads > 1 ? num_threads : 1;
+    pool->slots = calloc(num_slots, sizeof(struct thread_slot));
+    if (!pool->slots) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        thread_pool_free(pool);
+        return NULL;
+    }
+
+    for (; pool->num_slots < num_slots; pool->num_slots++) {
+        struct thread_slot *slot = &pool->slots[pool->num_slots];
+        slot->pool = pool;
+        pthread_mutex_init(&slot->mutex, NULL);
+    }
+
+    for (; pool->num_workers < num_slots - 1; pool->num_workers++) {
+        struct thread_slot *slot = &pool->slots[pool->num_workers + 1];
+        if (pthread_create(&slot->thread, NULL, run_worker_thread, slot)) {
+            fprintf(stderr, "Unable to start thread (%d)\n", __LINE__);
+
+            thread_pool_free(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void thread_pool_free(struct thread_pool *pool) {
+    if (!pool) { return; }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutting_down = 1;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->slots[i + 1].thread, NULL);
+    }
+
+    for (int i = 0; i < pool->num_slots; i++) {
+        pthread_mutex_destroy(&pool->slots[i].mutex);
+    }
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->changed);
+    if (pool->slots) { free(pool->slots); }
+    free(pool);
+}
+
+int thread_pool_num_threads(const struct thread_pool *pool) {
+    return pool ? pool->num_workers + 1 : 1;
+}
+
+void thread_pool_parallel_for(
+        struct thread_pool *pool,
+        int num_tasks,
+        void (*task)(void *context, int index),
+        void *context) {
+    if (!pool || pool->num_workers == 0 || num_tasks <= 1) {
+        for (int i = 0; i < num_tasks; i++) { task(context, i); }
+        return;
+    }
+
+    struct thread_slot *self = slot_of_current_thread(pool);
+    struct parallel_loop loop = {
+        .task = task,
+        .context = context,
+        .num_tasks = num_tasks,
+        .depth = current_depth
+    };
+    atomic_init(&loop.next_task, 1);
+    atomic_init(&loop.num_unfinished, num_tasks);
+
+    pthread_mutex_lock(&self->mutex);
+    loop.older = self->loops;
+    self->loops = &loop;
+    pthread_mutex_unlock(&self->mutex);
+
+    signal_change(pool);
+
+    run_claimed_tasks(pool, &loop, 0);
+
+    // Every task is claimed, so no other thread can find the loop any more
+    // once it's removed. Only the tasks already claimed are left to wait for.
+    pthread_mutex_lock(&self->mutex);
+    self->loops = loop.older;
+    pthread_mutex_unlock(&self->mutex);
+
+    // While waiting, this thread helps with the other loops, but only with
+    // those at least as deep as this one, so it doesn't get stuck in a long
+    // outer task while the rest of its own caller waits.
+    while (atomic_load(&loop.num_unfinished) > 0) {
+        unsigned long events = current_events(pool);
+        if (steal_tasks(pool, loop.depth)) { continue; }
+
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->events == events &&
+                atomic_load(&loop.num_unfinished) > 0) {
+            pthread_cond_wait(&pool->changed, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
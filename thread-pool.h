@@ -0,0 +1,41 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// A fixed set of worker threads, started once and reused for every parallel
+// stage of the carving, so no threads are created per iteration.
+//
+// Work is submitted as a parallel loop over a number of independent tasks.
+// The calling thread takes part in the loop, and only returns once every
+// task has finished, so the tasks can use data on the caller's stack.
+//
+// Tasks can start loops of their own, for example to carve many images at
+// once while still splitting the work on each image. Idle threads steal
+// tasks from the loops of busy threads, and a thread waiting for the end of
+// its loop helps with the other loops in the meantime.
+
+struct thread_pool;
+
+// Starts a pool running loops on `num_threads` threads in total, including
+// the thread calling `thread_pool_parallel_for`. With a single thread, no
+// worker threads are started and loops run on the calling thread. Returns
+// NULL on error.
+struct thread_pool * thread_pool_create(int num_threads);
+
+// Stops the worker threads and frees the pool. Must not be called while a
+// loop is running.
+void thread_pool_free(struct thread_pool *pool);
+
+// The total number of threads running loops, or 1 for a NULL pool.
+int thread_pool_num_threads(const struct thread_pool *pool);
+
+// Calls `task(context, i)` for every i from 0 to num_tasks - 1, spread across
+// the threads of the pool, and waits for all of them to return. A NULL pool
+// runs the tasks in order on the calling thread. Outside of the tasks, loops
+// must only be started from one thread at a time.
+void thread_pool_parallel_for(
+        struct thread_pool *pool,
+        int num_tasks,
+        void (*task)(void *context, int index),
+        void *context);
+
+#endif
@@ -0,0 +1,301 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.h"
+
+struct trace_event {
+    enum trace_stage stage;
+    int iteration;
+    int thread;
+
+    // In nanoseconds since the trace was created.
+    unsigned long long start;
+    unsigned long long duration;
+
+    long long pixels;
+    long long bytes;
+};
+
+struct trace {
+    // Guards the events, which are recorded from any thread.
+    pthread_mutex_t mutex;
+
+    unsigned long long origin;
+
+    struct trace_event *events;
+    int num_events;
+    int capacity;
+
+    // Events that couldn't be recorded for lack of memory. They are reported
+    // rather than failing the carving.
+    int num_dropped;
+};
+
+static const char *stage_names[NUM_TRACE_STAGES] = {
+    [TRACE_DECODE] = "decode",
+    [TRACE_SETUP] = "setup",
+    [TRACE_ENERGY] = "energy",
+    [TRACE_SEAM_LINKS] = "seam_links",
+    [TRACE_SEAMS] = "seams",
+    [TRACE_PYRAMID] = "pyramid",
+    [TRACE_REMOVAL] = "removal",
+    [TRACE_ORDER] = "order",
+    [TRACE_CALLBACK] = "callback",
+    [TRACE_ENCODE] = "encode",
+    [TRACE_WRITE] = "write"
+};
+
+// Threads are numbered in the order they first record a span, so the main
+// thread is usually thread 1.
+static atomic_int num_threads;
+static _Thread_local int current_thread;
+
+struct trace * trace_create(void) {
+    struct trace *trace = calloc(1, sizeof(struct trace));
+    if (!trace) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+        return NULL;
+    }
+
+    pthread_mutex_init(&trace->mutex, NULL);
+    trace->origin = trace_clock();
+
+    return trace;
+}
+
+void trace_free(struct trace *trace) {
+    if (!trace) { return; }
+
+    pthread_mutex_destroy(&trace->mutex);
+    if (trace->events) { free(trace->events); }
+    free(trace);
+}
+
+const char * trace_stage_name(enum trace_stage stage) {
+    return stage_names[stage];
+}
+
+unsigned long long trace_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void trace_record(
+        struct trace *trace,
+        enum trace_stage stage,
+        int iteration,
+        unsigned long long start,
+        long long pixels,
+        long long bytes) {
+    unsigned long long end = trace_clock();
+
+    if (!current_thread) {
+        current_thread = atomic_fetch_add(&num_threads, 1) + 1;
+    }
+
+    pthread_mutex_lock(&trace->mutex);
+
+    if (trace->num_events == trace->capacity) {
+        int capacity = trace->capacity ? trace->capacity * 2 : 1024;
+        struct trace_event *events =
+            realloc(trace->events, capacity * sizeof(struct trace_event));
+        if (!events) {
+            trace->num_dropped++;
+            pthread_mutex_unlock(&trace->mutex);
+            return;
+        }
+
+        trace->events = events;
+        trace->capacity = capacity;
+    }
+
+    trace->events[trace->num_events++] = (struct trace_event) {
+        .stage = stage,
+        .iteration = iteration,
+        .thread = current_thread,
+        .start = start - trace->origin,
+        .duration = end - start,
+        .pixels = pixels,
+        .bytes = bytes
+    };
+
+    pthread_mutex_unlock(&trace->mutex);
+}
+
+static int compare_durations(const void *a, const void *b) {
+    unsigned long long duration_a = *(const unsigned long long *) a;
+    unsigned long long duration_b = *(const unsigned long long *) b;
+
+    return (duration_a > duration_b) - (duration_a < duration_b);
+}
+
+int trace_stage_stats(
+        struct trace *trace,
+        enum trace_stage stage,
+        struct trace_stage_stats *stats) {
+    int result = 0;
+
+    *stats = (struct trace_stage_stats) { 0 };
+
+    pthread_mutex_lock(&trace->mutex);
+
+    unsigned long long *durations =
+        malloc((trace->num_events + 1) * sizeof(unsigned long long));
+    if (!durations) {
+        fprintf(stderr, "Unable to allocate memory (%d)\n", __LINE__);
+
+        result = 1;
+        goto cleanup;
+    }
+
+    unsigned long long total = 0;
+    long long pixels = 0;
+    int n = 0;
+    for (int i = 0; i < trace->num_events; i++) {
+        const struct trace_event *event = &trace->events[i];
+        if (event->stage != stage) { continue; }
+
+        durations[n++] = event->duration;
+        total += event->duration;
+        pixels += event->pixels;
+    }
+
+    if (n == 0) { goto cleanup; }
+
+    // The median averages the two middle spans, while the 95th percentile
+    // is the span at that rank.
+    qsort(durations, n, sizeof(unsigned long long), compare_durations);
+
+    stats->num_spans = n;
+    stats->total = total / 1e6;
+    stats->median = (durations[(n - 1) / 2] + durations[n / 2]) / 2e6;
+    stats->p95 = durations[(n * 95 + 99) / 100 - 1] / 1e6;
+    stats->throughput = total > 0 ? pixels * 1e3 / total : 0.0;
+
+cleanup:
+    pthread_mutex_unlock(&trace->mutex);
+    if (durations) { free(durations); }
+
+    return result;
+}
+
+int trace_write_chrome(struct trace *trace, const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Unable to write '%s'\n", filename);
+        return 1;
+    }
+
+    pthread_mutex_lock(&trace->mutex);
+
+    // Complete events, with the timestamps in microseconds.
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int i = 0; i < trace->num_events; i++) {
+        const struct trace_event *event = &trace->events[i];
+
+        fprintf(
+                file,
+                "{\"name\":\"%s\",\"cat\":\"carver\",\"ph\":\"X\","
+                "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,"
+                "\"args\":{",
+                stage_names[event->stage],
+                event->start / 1e3,
+                event->duration / 1e3,
+                event->thread);
+        if (event->iteration >= 0) {
+            fprintf(file, "\"iteration\":%d,", event->iteration);
+        }
+        fprintf(
+                file,
+                "\"pixels\":%lld,\"bytes\":%lld}}%s\n",
+                event->pixels,
+                event->bytes,
+                i + 1 < trace->num_events ? "," : "");
+    }
+    fprintf(file, "]}\n");
+
+    pthread_mutex_unlock(&trace->mutex);
+
+    if (fclose(file)) {
+        fprintf(stderr, "Unable to write '%s'\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+void trace_print_summary(struct trace *trace, FILE *stream) {
+    struct {
+        int count;
+        unsigned long long duration;
+        long long pixels;
+        long long bytes;
+    } stages[NUM_TRACE_STAGES] = { { 0 } };
+
+    pthread_mutex_lock(&trace->mutex);
+
+    unsigned long long first_start = ~0ULL;
+    unsigned long long last_end = 0;
+    for (int i = 0; i < trace->num_events; i++) {
+        const struct trace_event *event = &trace->events[i];
+
+        stages[event->stage].count++;
+        stages[event->stage].duration += event->duration;
+        stages[event->stage].pixels += event->pixels;
+        stages[event->stage].bytes += event->bytes;
+
+        if (event->start < first_start) { first_start = event->start; }
+        if (event->start + event->duration > last_end) {
+            last_end = event->start + event->duration;
+        }
+    }
+
+    int num_dropped = trace->num_dropped;
+    pthread_mutex_unlock(&trace->mutex);
+
+    // Spans on different threads overlap, as do nested spans, so the shares
+    // don't necessarily add up to 100%.
+    double wall_ms =
+        last_end > first_start ? (last_end - first_start) / 1e6 : 0.0;
+
+    fprintf(
+            stream,
+            "%-12s %8s %12s %10s %7s %10s %10s\n",
+            "stage",
+            "spans",
+            "total ms",
+            "mean ms",
+            "share",
+            "MP/s",
+            "alloc MB");
+
+    for (int stage = 0; stage < NUM_TRACE_STAGES; stage++) {
+        if (!stages[stage].count) { continue; }
+
+        double total_ms = stages[stage].duration / 1e6;
+        fprintf(
+                stream,
+                "%-12s %8d %12.3f %10.3f %6.1f%% %10.2f %10.2f\n",
+                stage_names[stage],
+                stages[stage].count,
+                total_ms,
+                total_ms / stages[stage].count,
+                wall_ms > 0 ? 100 * total_ms / wall_ms : 0.0,
+                total_ms > 0 ? stages[stage].pixels / 1e3 / total_ms : 0.0,
+                stages[stage].bytes / 1e6);
+    }
+
+    fprintf(stream, "%-12s %8s %12.3f\n", "wall", "", wall_ms);
+
+    if (num_dropped) {
+        fprintf(
+                stream,
+                "%d spans were dropped for lack of memory\n",
+                num_dropped);
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+// Records how long each stage of the carving takes, on every iteration,
+// along with the number of pixels the stage covered and the number of bytes
+// it allocated. The recorded spans can be written as a Chrome trace, to be
+// opened in chrome://tracing or Perfetto, and summarized per stage.
+//
+// Every function taking a trace accepts NULL, in which case nothing is
+// recorded. `trace_begin` and `trace_end` are inlined, so without a trace,
+// timing a stage only costs a branch on the trace pointer.
+//
+// Spans can be recorded from any thread. Spans recorded on the same thread
+// may nest, for example the energy computed while searching for a seam
+// order.
+
+enum trace_stage {
+    TRACE_DECODE,
+    TRACE_SETUP,
+    TRACE_ENERGY,
+    TRACE_SEAM_LINKS,
+    TRACE_SEAMS,
+    TRACE_PYRAMID,
+    TRACE_REMOVAL,
+    TRACE_ORDER,
+    TRACE_CALLBACK,
+    TRACE_ENCODE,
+    TRACE_WRITE,
+    NUM_TRACE_STAGES
+};
+
+struct trace;
+
+// Returns NULL on error.
+struct trace * trace_create(void);
+
+void trace_free(struct trace *trace);
+
+const char * trace_stage_name(enum trace_stage stage);
+
+// The current time on a monotonic clock, in nanoseconds.
+unsigned long long trace_clock(void);
+
+// Records a span of `stage` from `start`, as returned by `trace_begin`, to
+// now. `iteration` is negative for spans outside of any iteration.
+void trace_record(
+        struct trace *trace,
+        enum trace_stage stage,
+        int iteration,
+        unsigned long long start,
+        long long pixels,
+        long long bytes);
+
+static inline unsigned long long trace_begin(const struct trace *trace) {
+    return trace ? trace_clock() : 0;
+}
+
+static inline void trace_end(
+        struct trace *trace,
+        enum trace_stage stage,
+        int iteration,
+        unsigned long long start,
+        long long pixels,
+        long long bytes) {
+    if (trace) { trace_record(trace, stage, iteration, start, pixels, bytes); }
+}
+
+struct trace_stage_stats {
+    int num_spans;
+
+    // In milliseconds, over every span of the stage.
+    double total;
+    double median;
+    double p95;
+
+    // The pixels covered by the stage, in megapixels, per second spent in
+    // the stage.
+    double throughput;
+};
+
+// Computes the statistics of every span of `stage` recorded so far. Returns
+// non-zero on error.
+int trace_stage_stats(
+        struct trace *trace,
+        enum trace_stage stage,
+        struct trace_stage_stats *stats);
+
+// Writes every span recorded so far as a Chrome trace in the JSON format.
+// Returns non-zero on error.
+int trace_write_chrome(struct trace *trace, const char *filename);
+
+// Prints a table with the number of spans of each stage, their total and
+// mean durations, their share of the time from the first span to the last,
+// and the throughput and allocations of the stage.
+void trace_print_summary(struct trace *trace, FILE *stream);
+
+#endif